@@ -4,6 +4,11 @@
 #include "gpiomem_dummy_cdev.h"
 #include "gpiomem_dummy_procfs.h"
 #include "gpiomem_dummy_pdev.h"
+#include "gpiomem_dummy_probe.h"
+#include "gpiomem_dummy_board.h"
+#include "gpiomem_dummy_debugfs.h"
+#include "gpiomem_dummy_lat.h"
+#include "gpiomem_dummy_prof.h"
 
 #define DEVICE_NAME "gpiomem"    ///< The device will appear at /dev/gpiomem using this value
 #define CLASS_NAME  "gpiomem"        ///< The device class -- this is a character device driver
@@ -20,9 +25,20 @@
 
 #define BCM283X_GPIO_PGOFF (BCM283X_GPIO_OFFSET >> PAGE_SHIFT)
 
+/* /dev/gpiomem style clients map the gpio block at offset 0, /dev/mem style
+ * ones map the whole peripheral window at its bus address */
+#define gd_pgoff_is_gpio(pgoff) \
+   ((pgoff) == 0 || (pgoff) == BCM283X_PERIPH_PGOFF + BCM283X_GPIO_PGOFF)
+
+#define GD_CTRL_PGOFF (GD_CTRL_OFFSET >> PAGE_SHIFT)
+#define GD_RING_PGOFF (GD_RING_OFFSET >> PAGE_SHIFT)
+
 #define KALLOC_MEM_SIZE PAGE_SIZE
 
 #include <linux/mm_types.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/xarray.h>
 
 
 struct gpiomem_dummy
@@ -33,8 +49,22 @@ struct gpiomem_dummy
    struct gpiomem_dummy_procfs proc; // our proc device state;
 
    struct page *page; // our page!
+   struct xarray periph_pages; // pgoff -> page backing a peripheral page we don't emulate, never traps
+   struct page *ctrl_page; // harness control page (GD_CTRL_OFFSET), never traps
+   struct gd_board board; // register model behind page
 
    struct list_head probe_list; // list of tasks (gd_probe_info) that have mmaped us
+   DECLARE_HASHTABLE(probe_hash, GD_PROBE_HASH_BITS); // same probes, keyed by (mm, vaddr)
+   DECLARE_HASHTABLE(site_hash, GD_PROBE_HASH_BITS); // gd_probe_site, keyed by (inode, ip)
+   spinlock_t probe_lock; // serializes probe_list/probe_hash/site_hash writers, readers use rcu
+   struct list_head pending_sites; // sites waiting for their uprobe
+   struct list_head dead_sites; // sites no mm uses anymore
+   struct work_struct site_work; // registers pending_sites, unregisters dead_sites
+
+   struct gd_lat lat; // where the time in a trapped access goes
+   struct gd_prof prof; // which client code the accesses come from
+
+   struct dentry *debugfs; // our debugfs dir, NULL without one
 };
 
 #define check_error(thing, fmt, ...) do { \
@@ -87,6 +117,7 @@ goto err_cleanup; \
 int gd_set_page_ro(struct page *page);
 int gd_set_page_rw(struct page *page);
 struct gpiomem_dummy *gd_get(void);
+void gd_reset(struct gpiomem_dummy *gd);
 
 static inline
 struct gpiomem_dummy *gd_cdev_get_dummy(struct gpiomem_dummy_cdev *cd)
@@ -0,0 +1,339 @@
+#include "gpiomem_dummy_backend.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "backend: "
+
+static unsigned int backend_spin_us = 50;
+module_param(backend_spin_us, uint, 0644);
+MODULE_PARM_DESC(backend_spin_us, "most a trapped access spins on the backend ring before sleeping");
+
+static unsigned int backend_timeout_ms = 1000;
+module_param(backend_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(backend_timeout_ms, "how long a trapped write waits for ring space before falling back to the register model");
+
+// reads wait from inside the page fault, with the client's mm locked
+static unsigned int backend_read_timeout_ms = 10;
+module_param(backend_read_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(backend_read_timeout_ms, "how long a trapped read waits on the backend before falling back to the register model");
+
+// never spin less than this, a wakeup costs about as much
+#define GD_BACKEND_SPIN_MIN_NS 2000
+
+void gd_backend_init(struct gd_backend *be)
+{
+   memset(be, 0, sizeof(*be));
+   mutex_init(&be->lock);
+   spin_lock_init(&be->ring_lock);
+   init_waitqueue_head(&be->kernel_wait);
+   init_waitqueue_head(&be->backend_wait);
+}
+
+int gd_backend_attach(struct gd_backend *be, u64 regs, void *owner)
+{
+   struct page *page = NULL;
+   int ret = 0;
+
+   regs &= (1ULL << GD_NUM_REGS) - 1;
+   if(!regs)
+   {
+      return -EINVAL;
+   }
+
+   BUILD_BUG_ON(sizeof(struct gd_ring) > PAGE_SIZE);
+
+   page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+   if(!page)
+   {
+      return -ENOMEM;
+   }
+
+   mutex_lock(&be->lock);
+
+   if(be->owner)
+   {
+      ret = -EBUSY;
+      __free_page(page);
+   }
+   else
+   {
+      spin_lock(&be->ring_lock);
+      be->owner = owner;
+      be->ring_page = page;
+      be->ring = page_address(page);
+      spin_unlock(&be->ring_lock);
+      be->dead = false;
+      be->seq = 0;
+      be->avg_ns = 0;
+      WRITE_ONCE(be->regs, regs);
+   }
+
+   mutex_unlock(&be->lock);
+
+   return ret;
+}
+
+/* stop routing accesses to owner's backend. clients stuck waiting on it fall
+ * back to the register model. a mapping of the ring keeps its page */
+void gd_backend_detach(struct gd_backend *be, void *owner)
+{
+   struct page *page = NULL;
+
+   if(READ_ONCE(be->owner) != owner)
+   {
+      return;
+   }
+
+   WRITE_ONCE(be->regs, 0);
+   WRITE_ONCE(be->dead, true);
+   wake_up_all(&be->kernel_wait);
+   wake_up_all(&be->backend_wait);
+
+   mutex_lock(&be->lock);
+
+   if(be->owner == owner)
+   {
+      spin_lock(&be->ring_lock);
+      page = be->ring_page;
+      be->ring_page = NULL;
+      be->ring = NULL;
+      be->owner = NULL;
+      spin_unlock(&be->ring_lock);
+
+      __free_page(page);
+   }
+
+   mutex_unlock(&be->lock);
+}
+
+int gd_backend_mmap(struct gd_backend *be, struct vm_area_struct *vma, void *owner)
+{
+   int ret = 0;
+
+   if(vma->vm_end - vma->vm_start != PAGE_SIZE)
+   {
+      return -EINVAL;
+   }
+
+   mutex_lock(&be->lock);
+
+   if(be->owner != owner || !be->ring_page)
+   {
+      ret = -ENODEV;
+   }
+   else
+   {
+      // takes a page reference, so the ring outlives a detach while mapped
+      ret = vm_insert_page(vma, vma->vm_start, be->ring_page);
+   }
+
+   mutex_unlock(&be->lock);
+
+   return ret;
+}
+
+/* backend side: sleep until there's a request to service. not under
+ * be->lock, a client read holds that while waiting for this very backend */
+int gd_backend_wait(struct gd_backend *be, void *owner)
+{
+   struct page *page = NULL;
+   struct gd_ring *ring = NULL;
+   int ret = 0;
+
+   spin_lock(&be->ring_lock);
+   if(be->owner == owner && be->ring_page)
+   {
+      // a detach mid wait mustn't free the ring under us
+      page = be->ring_page;
+      get_page(page);
+      ring = be->ring;
+   }
+   spin_unlock(&be->ring_lock);
+
+   if(!ring)
+   {
+      return -ENODEV;
+   }
+
+   ret = wait_event_interruptible(be->backend_wait,
+      READ_ONCE(ring->req_head) != READ_ONCE(ring->req_tail) || READ_ONCE(be->dead));
+
+   put_page(page);
+
+   return ret;
+}
+
+/* backend side: responses (or ring space) are there */
+void gd_backend_kick(struct gd_backend *be, void *owner)
+{
+   if(READ_ONCE(be->owner) == owner)
+   {
+      wake_up_all(&be->kernel_wait);
+   }
+}
+
+static void gd_backend_notify(struct gd_backend *be)
+{
+   smp_mb(); // the new req_head against the backend's sleeping flag
+   if(READ_ONCE(be->ring->backend_sleeping))
+   {
+      wake_up_all(&be->backend_wait);
+   }
+}
+
+/* spin on cond for a while, about twice what responses have been taking,
+ * then sleep until the backend kicks us. -ETIMEDOUT if it doesn't answer
+ * within timeout_ms */
+#define gd_backend_poll(be, cond, timeout_ms) ({ \
+   u64 start_ = ktime_get_ns(); \
+   u64 spin_ = clamp_t(u64, 2 * (be)->avg_ns, GD_BACKEND_SPIN_MIN_NS, (u64)backend_spin_us * NSEC_PER_USEC); \
+   long left_ = 1; \
+   while(!(cond) && !READ_ONCE((be)->dead) && ktime_get_ns() - start_ < spin_) \
+   { \
+      cpu_relax(); \
+   } \
+   if(!(cond) && !READ_ONCE((be)->dead)) \
+   { \
+      WRITE_ONCE((be)->ring->kernel_sleeping, 1); \
+      smp_mb(); \
+      left_ = wait_event_killable_timeout((be)->kernel_wait, (cond) || READ_ONCE((be)->dead), \
+         msecs_to_jiffies(timeout_ms)); \
+      WRITE_ONCE((be)->ring->kernel_sleeping, 0); \
+   } \
+   (cond) ? 0 : (left_ < 0 ? (int)left_ : -ETIMEDOUT); \
+})
+
+/* queue a request, waiting up to timeout_ms for space if the backend is behind */
+static int gd_backend_post(struct gd_backend *be, unsigned int off, u32 val, u32 flags,
+                           struct task_struct *task, unsigned int timeout_ms, u32 *seq)
+{
+   struct gd_ring *ring = be->ring;
+   struct gd_ring_req *req = NULL;
+   u32 head = ring->req_head;
+   int ret = 0;
+
+   ret = gd_backend_poll(be, head - READ_ONCE(ring->req_tail) < GD_RING_SIZE, timeout_ms);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   req = &ring->req[head % GD_RING_SIZE];
+   req->seq = *seq = ++be->seq;
+   req->off = off;
+   req->val = val;
+   req->flags = flags;
+   req->pid = gd_task_tgid(task);
+   req->tid = gd_task_tid(task);
+
+   smp_wmb(); // the entry before the head
+   WRITE_ONCE(ring->req_head, head + 1);
+
+   gd_backend_notify(be);
+
+   return 0;
+}
+
+/* have the backend produce the value a client read of off sees */
+int gd_backend_read(struct gd_backend *be, unsigned int off, u32 *val)
+{
+   struct gd_ring *ring = NULL;
+   struct gd_ring_rsp *rsp = NULL;
+   u64 start = ktime_get_ns();
+   unsigned int timeout_ms = READ_ONCE(backend_read_timeout_ms);
+   u32 seq = 0, rsp_seq = 0;
+   int ret = 0;
+
+   // someone else's transaction in flight, don't queue up behind it in the
+   // fault. the register model answers instead
+   if(!mutex_trylock(&be->lock))
+   {
+      return -EBUSY;
+   }
+
+   ring = be->ring;
+   if(!ring || be->dead)
+   {
+      ret = -ENODEV;
+      goto out;
+   }
+
+   ret = gd_backend_post(be, off, 0, 0, current, timeout_ms, &seq);
+   if(ret != 0)
+   {
+      goto out;
+   }
+
+   // one read in flight at a time, but reads that timed out earlier can
+   // still have their late answers queued ahead of ours. those are dropped
+   for(;;)
+   {
+      ret = gd_backend_poll(be, READ_ONCE(ring->rsp_head) != ring->rsp_tail, timeout_ms);
+      if(ret != 0)
+      {
+         pr_err("backend didn't answer read of 0x%x: %d", off, ret);
+         goto out;
+      }
+
+      smp_rmb(); // the head before the entry
+      rsp = &ring->rsp[ring->rsp_tail % GD_RING_SIZE];
+      rsp_seq = READ_ONCE(rsp->seq);
+      *val = READ_ONCE(rsp->val);
+      smp_mb(); // done with the entry before handing it back
+      WRITE_ONCE(ring->rsp_tail, ring->rsp_tail + 1);
+
+      if(rsp_seq == seq)
+      {
+         break;
+      }
+
+      if((s32)(rsp_seq - seq) > 0)
+      {
+         pr_err("backend answered %u, expected %u", rsp_seq, seq);
+         ret = -EPROTO;
+         goto out;
+      }
+   }
+
+   be->avg_ns = (be->avg_ns * 7 + (ktime_get_ns() - start)) / 8;
+
+out:
+   mutex_unlock(&be->lock);
+   return ret;
+}
+
+/* writes are posted, the client carries on once the request is queued. task
+ * made the access, which may not be current */
+int gd_backend_write(struct gd_backend *be, unsigned int off, u32 val, struct task_struct *task)
+{
+   u32 seq = 0;
+   int ret = 0;
+
+   ret = mutex_lock_killable(&be->lock);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   if(!be->ring || be->dead)
+   {
+      ret = -ENODEV;
+   }
+   else
+   {
+      ret = gd_backend_post(be, off, val, GD_RING_WRITE, task, READ_ONCE(backend_timeout_ms), &seq);
+   }
+
+   mutex_unlock(&be->lock);
+
+   return ret;
+}
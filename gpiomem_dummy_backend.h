@@ -0,0 +1,49 @@
+#ifndef GPIOMEM_DUMMY_BACKEND_H_GUARD
+#define GPIOMEM_DUMMY_BACKEND_H_GUARD
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/mm_types.h>
+
+#include "gpiomem_dummy_ioctl.h"
+
+/* a userspace process servicing some of the registers through a shared
+ * gd_ring. at most one per board */
+struct gd_backend
+{
+   struct mutex lock; // one client transaction at a time, and attach/detach
+   spinlock_t ring_lock; // owner and ring changes too, for the backend side
+   wait_queue_head_t kernel_wait; // clients waiting on a response or ring space
+   wait_queue_head_t backend_wait; // the backend waiting on a request
+
+   u64 regs; // registers it services, bit n = offset 4n. 0 when detached
+   bool dead; // detaching, waiters give up
+   void *owner; // the file that attached it
+   struct page *ring_page;
+   struct gd_ring *ring;
+   u32 seq;
+
+   u64 avg_ns; // running average response time, scales the spin
+};
+
+void gd_backend_init(struct gd_backend *be);
+int gd_backend_attach(struct gd_backend *be, u64 regs, void *owner);
+void gd_backend_detach(struct gd_backend *be, void *owner);
+int gd_backend_mmap(struct gd_backend *be, struct vm_area_struct *vma, void *owner);
+
+int gd_backend_wait(struct gd_backend *be, void *owner);
+void gd_backend_kick(struct gd_backend *be, void *owner);
+
+int gd_backend_read(struct gd_backend *be, unsigned int off, u32 *val);
+int gd_backend_write(struct gd_backend *be, unsigned int off, u32 val, struct task_struct *task);
+
+static inline
+bool gd_backend_claims(struct gd_backend *be, unsigned int off)
+{
+   return READ_ONCE(be->regs) & (1ULL << (off / 4));
+}
+
+#endif /* GPIOMEM_DUMMY_BACKEND_H_GUARD */
@@ -0,0 +1,1192 @@
+#include "gpiomem_dummy_board.h"
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/eventfd.h>
+#include <linux/math64.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+#include "gpiomem_dummy_model.h"
+#include "gpiomem_dummy_trace.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "board: "
+
+// waits shorter than this are spun, an hrtimer sleep isn't that precise
+#define GD_SPIN_NS (10 * NSEC_PER_USEC)
+
+// control page reads retried while racing the harness before giving up
+#define GD_CTRL_RETRIES 8
+
+// passes update makes to let models react to each other before giving up,
+// a model pair that keeps toggling each other is left for the next update
+#define GD_MODEL_PASSES 8
+
+// most waveform steps one tick applies, a far behind repeating wave catches
+// up over several ticks instead of looping in hardirq
+#define GD_WAVE_BATCH 256
+
+static enum hrtimer_restart gd_board_wave_tick(struct hrtimer *timer);
+static void gd_board_wave_stop_locked(struct gd_board *board);
+static bool gd_board_wave_valid(const struct gd_inject_step *steps, unsigned int count, u32 flags);
+static u64 gd_board_wave_period(const struct gd_inject_step *steps, unsigned int count);
+
+/* shift of the bank off falls in, for registers with a bit per pin */
+static inline
+unsigned int gd_bank_shift(unsigned int off, unsigned int base)
+{
+   return off == base ? 0 : 32;
+}
+
+/* a two word per-pin register as one pin word */
+static inline
+u64 gd_board_pins(struct gd_board *board, unsigned int base)
+{
+   return ((u64)board->regs[base / 4] | ((u64)board->regs[base / 4 + 1] << 32)) & GD_ALL_PINS;
+}
+
+static u64 gd_board_calc_outputs(struct gd_board *board)
+{
+   u64 outputs = 0;
+   unsigned int pin;
+
+   for(pin = 0; pin < GD_NUM_PINS; pin++)
+   {
+      u32 fsel = (board->regs[GD_GPFSEL0 / 4 + pin / 10] >> ((pin % 10) * 3)) & 7;
+
+      if(fsel == GD_FSEL_OUTPUT)
+      {
+         outputs |= 1ULL << pin;
+      }
+   }
+
+   return outputs;
+}
+
+void gd_board_init(struct gd_board *board, struct page *page, struct page *ctrl_page)
+{
+   memset(board, 0, sizeof(*board));
+
+   spin_lock_init(&board->lock);
+   INIT_LIST_HEAD(&board->watches);
+   INIT_LIST_HEAD(&board->evfds);
+   INIT_LIST_HEAD(&board->models);
+   board->page = page_address(page);
+   board->ctrl = page_address(ctrl_page);
+   board->epoch = ktime_get_ns();
+   mutex_init(&board->wave.lock);
+   gd_backend_init(&board->backend);
+   gd_record_init(&board->record);
+   gd_replay_init(&board->replay);
+   gd_vcd_init(&board->vcd);
+   gd_relay_init(&board->relay);
+   gd_stats_init(&board->stats);
+   gd_hrtimer_setup(&board->wave.timer, gd_board_wave_tick, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+
+   // power on: everything an input, nothing driven, no events
+   gd_board_sync_page_locked(board);
+}
+
+void gd_board_destroy(struct gd_board *board)
+{
+   gd_board_wave_stop(board);
+   gd_replay_destroy(&board->replay);
+   gd_stats_destroy(&board->stats);
+}
+
+/* the models start over along with the board, in the same lock hold. a
+ * timer callback already waiting on the lock still runs after this */
+static void gd_board_reset_models_locked(struct gd_board *board)
+{
+   struct gd_model *model = NULL;
+
+   board->model_dirty = false;
+
+   list_for_each_entry(model, &board->models, list)
+   {
+      gd_model_timer_cancel(model);
+
+      if(model->ops->reset)
+      {
+         model->ops->reset(model);
+      }
+   }
+
+   if(board->model_dirty)
+   {
+      gd_board_update_locked(board);
+   }
+}
+
+/* power-on state, in one lock hold so no client sees half of it. the control
+ * page is taken as already applied, so stale levels in it don't come back */
+void gd_board_reset(struct gd_board *board)
+{
+   struct gd_watch *watch = NULL;
+   unsigned long flags;
+
+   gd_board_wave_stop(board);
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   memset(board->regs, 0, sizeof(board->regs));
+   board->outputs = 0;
+   board->out = 0;
+   board->in = 0;
+   board->level = 0;
+   board->eds = 0;
+
+   memset(board->wire, 0, sizeof(board->wire));
+   board->wire_src = 0;
+
+   board->ctrl_seq = READ_ONCE(board->ctrl->seq) & ~1;
+   board->epoch = ktime_get_ns();
+
+   list_for_each_entry(watch, &board->watches, list)
+   {
+      watch->changed = 0;
+      watch->count = 0;
+   }
+
+   gd_board_reset_models_locked(board);
+   gd_board_sync_page_locked(board);
+
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+/* fill in snap, and up to room of the waveform's steps */
+int gd_board_save(struct gd_board *board, struct gd_snapshot *snap, struct gd_inject_step *steps, unsigned int room)
+{
+   struct gd_wave_state *wave = &board->wave;
+   unsigned long flags;
+   int ret = 0;
+
+   BUILD_BUG_ON(GD_SNAPSHOT_REGS != GD_NUM_REGS || GD_SNAPSHOT_PINS != GD_NUM_PINS);
+
+   memset(snap, 0, sizeof(*snap));
+   snap->version = GD_SNAPSHOT_VERSION;
+   snap->size = sizeof(*snap);
+
+   // the steps only change under the wave mutex
+   mutex_lock(&wave->lock);
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   gd_board_sample_locked(board);
+
+   snap->time_ns = ktime_get_ns() - board->epoch;
+   memcpy(snap->regs, board->regs, sizeof(snap->regs));
+   snap->out = board->out;
+   snap->in = board->in;
+   snap->level = board->level;
+   snap->eds = board->eds;
+   memcpy(snap->wire, board->wire, sizeof(snap->wire));
+
+   // a one-shot wave that has played out is idle, only stop frees it
+   snap->wave_count = wave->steps && wave->pos < wave->count ? wave->count : 0;
+   if(snap->wave_count)
+   {
+      snap->wave_pos = wave->pos;
+      snap->wave_flags = wave->flags;
+      snap->wave_slack_ns = wave->slack;
+      snap->wave_next_ns = wave->next - board->epoch;
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   if(snap->wave_count > room)
+   {
+      ret = -ENOSPC;
+   }
+   else if(snap->wave_count)
+   {
+      memcpy(steps, wave->steps, snap->wave_count * sizeof(*steps));
+   }
+
+   mutex_unlock(&wave->lock);
+
+   return ret;
+}
+
+/* the board as snap has it. takes steps (kvmalloc'd, snap->wave_count of
+ * them), even on failure */
+int gd_board_restore(struct gd_board *board, const struct gd_snapshot *snap, struct gd_inject_step *steps)
+{
+   struct gd_wave_state *wave = &board->wave;
+   unsigned long flags;
+   u64 now = 0;
+   unsigned int pin;
+
+   if(snap->version != GD_SNAPSHOT_VERSION || snap->size != sizeof(*snap) ||
+      (snap->wave_count && (snap->wave_pos >= snap->wave_count ||
+                            !gd_board_wave_valid(steps, snap->wave_count, snap->wave_flags))))
+   {
+      kvfree(steps);
+      return -EINVAL;
+   }
+
+   mutex_lock(&wave->lock);
+
+   gd_board_wave_stop_locked(board);
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   now = ktime_get_ns();
+   board->epoch = now - snap->time_ns;
+
+   memcpy(board->regs, snap->regs, sizeof(board->regs));
+   board->outputs = gd_board_calc_outputs(board);
+   board->out = snap->out & GD_ALL_PINS;
+   board->in = snap->in & GD_ALL_PINS;
+   board->level = snap->level & GD_ALL_PINS;
+   board->eds = snap->eds & GD_ALL_PINS;
+
+   board->wire_src = 0;
+   for(pin = 0; pin < GD_NUM_PINS; pin++)
+   {
+      board->wire[pin] = snap->wire[pin] & GD_ALL_PINS;
+      if(board->wire[pin])
+      {
+         board->wire_src |= 1ULL << pin;
+      }
+   }
+
+   board->ctrl_seq = READ_ONCE(board->ctrl->seq) & ~1;
+
+   if(snap->wave_count)
+   {
+      wave->steps = steps;
+      wave->count = snap->wave_count;
+      wave->pos = snap->wave_pos;
+      wave->flags = snap->wave_flags;
+      wave->slack = snap->wave_slack_ns;
+      wave->period = gd_board_wave_period(steps, snap->wave_count);
+      wave->next = board->epoch + snap->wave_next_ns;
+      steps = NULL;
+   }
+
+   gd_board_sync_page_locked(board);
+   gd_vcd_event_locked(&board->vcd, snap->time_ns, board->level);
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   if(wave->steps)
+   {
+      hrtimer_start(&wave->timer, ns_to_ktime(wave->next), HRTIMER_MODE_ABS);
+   }
+
+   mutex_unlock(&wave->lock);
+
+   kvfree(steps);
+
+   return 0;
+}
+
+u64 gd_board_output_mask(struct gd_board *board)
+{
+   return board->outputs;
+}
+
+u32 gd_board_read_reg_locked(struct gd_board *board, unsigned int off)
+{
+   switch(off)
+   {
+      case GD_GPSET0:
+      case GD_GPSET0 + 4:
+      case GD_GPCLR0:
+      case GD_GPCLR0 + 4:
+         return 0; // write only
+
+      case GD_GPLEV0:
+      case GD_GPLEV0 + 4:
+         return (u32)(board->level >> gd_bank_shift(off, GD_GPLEV0));
+
+      case GD_GPEDS0:
+      case GD_GPEDS0 + 4:
+         return (u32)(board->eds >> gd_bank_shift(off, GD_GPEDS0));
+
+      default:
+         return board->regs[off / 4];
+   }
+}
+
+/* apply one register write. callers run gd_board_update_locked() once they're
+ * done with a batch */
+void gd_board_write_reg_locked(struct gd_board *board, unsigned int off, u32 val, unsigned int flags)
+{
+   u64 bits = 0;
+   unsigned int shift = 0;
+
+   switch(off)
+   {
+      case GD_GPSET0:
+      case GD_GPSET0 + 4:
+         board->out |= ((u64)val << gd_bank_shift(off, GD_GPSET0)) & GD_ALL_PINS;
+         break;
+
+      case GD_GPCLR0:
+      case GD_GPCLR0 + 4:
+         board->out &= ~((u64)val << gd_bank_shift(off, GD_GPCLR0));
+         break;
+
+      case GD_GPLEV0:
+      case GD_GPLEV0 + 4:
+         // read only for clients, the harness uses it to drive inputs
+         if(flags & GD_ACCESS_HARNESS)
+         {
+            shift = gd_bank_shift(off, GD_GPLEV0);
+            bits = 0xffffffffULL << shift;
+            board->in = (board->in & ~bits) | (((u64)val << shift) & GD_ALL_PINS);
+         }
+         break;
+
+      case GD_GPEDS0:
+      case GD_GPEDS0 + 4:
+         board->eds &= ~((u64)val << gd_bank_shift(off, GD_GPEDS0)); // write 1 to clear
+         break;
+
+      default:
+         board->regs[off / 4] = val;
+         if(off <= GD_GPFSEL5)
+         {
+            board->outputs = gd_board_calc_outputs(board);
+         }
+         break;
+   }
+}
+
+/* one AND per binding decides, only the few that match look at the edge */
+static void gd_board_signal_locked(struct gd_board *board, u64 rising, u64 falling)
+{
+   struct gd_evfd *evfd = NULL;
+
+   list_for_each_entry(evfd, &board->evfds, list)
+   {
+      if(!((rising | falling) & evfd->mask))
+      {
+         continue;
+      }
+
+      if(((evfd->edges & GD_EDGE_RISING) && (rising & evfd->mask)) ||
+         ((evfd->edges & GD_EDGE_FALLING) && (falling & evfd->mask)))
+      {
+         gd_eventfd_signal(evfd->ctx);
+      }
+   }
+}
+
+/* only the first change since a watcher last read wakes it, the rest just
+ * pile up in its changed mask and count */
+static void gd_board_notify_locked(struct gd_board *board, u64 rising, u64 falling)
+{
+   struct gd_watch *watch = NULL;
+   u64 changed = rising | falling;
+
+   if(changed & board->evfd_mask)
+   {
+      gd_board_signal_locked(board, rising, falling);
+   }
+
+   if(!(changed & board->watch_mask))
+   {
+      return;
+   }
+
+   list_for_each_entry(watch, &board->watches, list)
+   {
+      u64 hit = changed & watch->mask;
+      bool idle = !watch->count;
+
+      if(!hit)
+      {
+         continue;
+      }
+
+      watch->changed |= hit;
+      watch->count += hweight64(hit);
+
+      if(idle)
+      {
+         wake_up_interruptible_poll(&watch->wait, EPOLLPRI);
+      }
+   }
+}
+
+/* the inputs as the wiring matrix sees them: every driving source ors its
+ * level into its destinations, which stop following board->in */
+static u64 gd_board_wired_inputs(struct gd_board *board, u64 outputs)
+{
+   u64 srcs = board->wire_src & outputs;
+   u64 wired = 0;
+   u64 high = 0;
+
+   while(srcs)
+   {
+      unsigned int pin = __ffs64(srcs);
+
+      srcs &= srcs - 1;
+      wired |= board->wire[pin];
+      if(board->out & (1ULL << pin))
+      {
+         high |= board->wire[pin];
+      }
+   }
+
+   return (board->in & ~wired) | high;
+}
+
+/* hand the change to the models watching those pins */
+static void gd_board_dispatch_locked(struct gd_board *board, u64 level, u64 changed)
+{
+   struct gd_model *model = NULL;
+
+   list_for_each_entry(model, &board->models, list)
+   {
+      if((changed & model->pins) && model->ops->changed)
+      {
+         model->ops->changed(model, level, changed & model->pins);
+      }
+   }
+}
+
+static void gd_board_trace_pins(struct gd_board *board, u64 level, u64 rising, u64 falling)
+{
+   struct gd_bpf_pins ctx = {
+      .time = gd_board_time(board),
+      .level = level,
+      .rising = rising,
+      .falling = falling,
+   };
+
+   trace_gd_pins(&ctx);
+}
+
+static void gd_board_trace_access(struct gd_board *board, unsigned int off, u32 val, bool write,
+                                  struct task_struct *task)
+{
+   struct gd_bpf_access ctx = {
+      .time = gd_board_time(board),
+      .off = off,
+      .val = val,
+      .flags = write ? GD_BPF_WRITE : 0,
+      .pid = task_tgid_nr(task),
+      .tid = task_pid_nr(task),
+   };
+
+   trace_gd_access(&ctx);
+}
+
+static void gd_board_update_once_locked(struct gd_board *board)
+{
+   u64 outputs = board->outputs;
+   u64 in = board->wire_src ? gd_board_wired_inputs(board, outputs) : board->in;
+   u64 old = board->level;
+   u64 level = ((board->out & outputs) | (in & ~outputs)) & GD_ALL_PINS;
+   u64 rising = level & ~old;
+   u64 falling = old & ~level;
+
+   board->level = level;
+
+   board->eds |= rising & (gd_board_pins(board, GD_GPREN0) | gd_board_pins(board, GD_GPAREN0));
+   board->eds |= falling & (gd_board_pins(board, GD_GPFEN0) | gd_board_pins(board, GD_GPAFEN0));
+   board->eds |= level & gd_board_pins(board, GD_GPHEN0);
+   board->eds |= ~level & gd_board_pins(board, GD_GPLEN0);
+
+   if(rising | falling)
+   {
+      if(gd_vcd_active(&board->vcd))
+      {
+         gd_vcd_event_locked(&board->vcd, gd_board_time(board), level);
+      }
+
+      gd_stats_toggles(&board->stats, rising | falling);
+
+      if(trace_gd_pins_enabled())
+      {
+         gd_board_trace_pins(board, level, rising, falling);
+      }
+
+      gd_board_notify_locked(board, rising, falling);
+
+      if((rising | falling) & board->model_mask)
+      {
+         gd_board_dispatch_locked(board, level, rising | falling);
+      }
+   }
+}
+
+/* recompute GPLEV from the output latch and inputs, and latch any events the
+ * change (or the new level) triggers. wired inputs follow their sources in
+ * the same step, so a GPSET on a looped back pin latches the input's edge
+ * right away, and so do inputs a model drives in response */
+void gd_board_update_locked(struct gd_board *board)
+{
+   unsigned int pass = 0;
+
+   do
+   {
+      board->model_dirty = false;
+      gd_board_update_once_locked(board);
+   } while(board->model_dirty && ++pass < GD_MODEL_PASSES);
+}
+
+/* refresh the mapped page so a client read sees the model */
+void gd_board_sync_page_locked(struct gd_board *board)
+{
+   unsigned int i;
+
+   for(i = 0; i < GD_NUM_REGS; i++)
+   {
+      WRITE_ONCE(board->page[i], gd_board_read_reg_locked(board, i * 4));
+   }
+}
+
+/* count registers starting at off, all read under one lock hold so the
+ * caller gets a consistent snapshot */
+void gd_board_read_regs(struct gd_board *board, unsigned int off, u32 *buf, unsigned int count)
+{
+   unsigned long flags;
+   unsigned int i;
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   gd_board_sample_locked(board);
+
+   for(i = 0; i < count; i++)
+   {
+      buf[i] = gd_board_read_reg_locked(board, off + i * 4);
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+void gd_board_write_regs(struct gd_board *board, unsigned int off, const u32 *buf, unsigned int count, unsigned int flags)
+{
+   unsigned long irqflags;
+   unsigned int i;
+
+   spin_lock_irqsave(&board->lock, irqflags);
+
+   for(i = 0; i < count; i++)
+   {
+      gd_board_write_reg_locked(board, off + i * 4, buf[i], flags);
+   }
+
+   gd_board_update_locked(board);
+   gd_board_sync_page_locked(board);
+
+   spin_unlock_irqrestore(&board->lock, irqflags);
+}
+
+/* drive the input levels of pins, edges get latched on the next update */
+void gd_board_set_inputs_locked(struct gd_board *board, u64 pins, u64 levels)
+{
+   pins &= GD_ALL_PINS;
+   board->in = (board->in & ~pins) | (levels & pins);
+}
+
+int gd_board_wire(struct gd_board *board, unsigned int src, u64 dst)
+{
+   unsigned long flags;
+
+   if(src >= GD_NUM_PINS)
+   {
+      return -EINVAL;
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   board->wire[src] = dst & GD_ALL_PINS;
+   if(board->wire[src])
+   {
+      board->wire_src |= 1ULL << src;
+   }
+   else
+   {
+      board->wire_src &= ~(1ULL << src);
+   }
+
+   gd_board_update_locked(board);
+   gd_board_sync_page_locked(board);
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   return 0;
+}
+
+void gd_board_unwire(struct gd_board *board)
+{
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   memset(board->wire, 0, sizeof(board->wire));
+   board->wire_src = 0;
+
+   gd_board_update_locked(board);
+   gd_board_sync_page_locked(board);
+
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+/* pick up whatever the harness stored in the control page since the last
+ * sample. the writer is userspace, so a seq stuck odd just means the old
+ * levels stay until the next sample rather than spinning here */
+void gd_board_sample_locked(struct gd_board *board)
+{
+   struct gd_ctrl_page *ctrl = board->ctrl;
+   unsigned int tries;
+   u32 seq;
+   u64 pins;
+   u64 levels;
+
+   for(tries = 0; tries < GD_CTRL_RETRIES; tries++)
+   {
+      seq = READ_ONCE(ctrl->seq);
+      if(seq == board->ctrl_seq)
+      {
+         return;
+      }
+
+      if(seq & 1)
+      {
+         cpu_relax();
+         continue;
+      }
+
+      smp_rmb();
+      pins = READ_ONCE(ctrl->pins);
+      levels = READ_ONCE(ctrl->levels);
+      smp_rmb();
+
+      if(READ_ONCE(ctrl->seq) == seq)
+      {
+         board->ctrl_seq = seq;
+         gd_board_set_inputs_locked(board, pins, levels);
+         gd_board_update_locked(board);
+         return;
+      }
+   }
+}
+
+/* wait until the absolute ktime_get_ns() deadline, -EINTR on a signal */
+static int gd_board_wait_until(u64 deadline)
+{
+   ktime_t expires;
+
+   // any wakeup ends the sleep early, only a signal ends the wait
+   while(deadline > ktime_get_ns() + GD_SPIN_NS)
+   {
+      if(signal_pending(current))
+      {
+         return -EINTR;
+      }
+
+      expires = ns_to_ktime(deadline - GD_SPIN_NS);
+
+      set_current_state(TASK_INTERRUPTIBLE);
+      schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS);
+   }
+
+   while(ktime_get_ns() < deadline)
+   {
+      cpu_relax();
+   }
+
+   return 0;
+}
+
+/* apply count input steps in order. runs of steps with no delay between them
+ * are applied under one lock hold, each still latching its own edges. delays
+ * are kept against the absolute schedule in *deadline (start it at
+ * ktime_get_ns()), so they don't drift with the time spent applying, even
+ * across calls. returns the number of steps applied, or -EINTR if a signal
+ * came in before the first */
+int gd_board_inject(struct gd_board *board, const struct gd_inject_step *steps, unsigned int count, u64 *deadline)
+{
+   unsigned long flags;
+   unsigned int i = 0;
+
+   while(i < count)
+   {
+      if(steps[i].delay_ns)
+      {
+         *deadline += steps[i].delay_ns;
+         if(gd_board_wait_until(*deadline) != 0)
+         {
+            return i ? i : -EINTR;
+         }
+      }
+
+      spin_lock_irqsave(&board->lock, flags);
+
+      do
+      {
+         gd_board_set_inputs_locked(board, steps[i].pins, steps[i].levels);
+         gd_board_update_locked(board);
+         i++;
+      } while(i < count && !steps[i].delay_ns);
+
+      gd_board_sync_page_locked(board);
+
+      spin_unlock_irqrestore(&board->lock, flags);
+   }
+
+   return i;
+}
+
+/* play every step that's due by the end of this tick's slack. they all go in
+ * under one lock hold and one page sync */
+static enum hrtimer_restart gd_board_wave_tick(struct hrtimer *timer)
+{
+   struct gd_board *board = container_of(timer, struct gd_board, wave.timer);
+   struct gd_wave_state *wave = &board->wave;
+   u64 now = ktime_to_ns(hrtimer_cb_get_time(timer));
+   enum hrtimer_restart ret = HRTIMER_RESTART;
+   unsigned int batch = 0;
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(!wave->steps)
+   {
+      spin_unlock_irqrestore(&board->lock, flags);
+      return HRTIMER_NORESTART;
+   }
+
+   while(wave->next <= now + wave->slack && batch++ < GD_WAVE_BATCH)
+   {
+      struct gd_inject_step *step = &wave->steps[wave->pos];
+
+      gd_board_set_inputs_locked(board, step->pins, step->levels);
+      gd_board_update_locked(board);
+
+      if(++wave->pos == wave->count)
+      {
+         if(!(wave->flags & GD_WAVE_REPEAT))
+         {
+            ret = HRTIMER_NORESTART;
+            break;
+         }
+
+         wave->pos = 0;
+      }
+
+      wave->next += wave->steps[wave->pos].delay_ns;
+   }
+
+   gd_board_sync_page_locked(board);
+
+   // a repeating wave still behind after a full batch drops whole loops
+   // rather than rearm in the past and come straight back in hardirq. a
+   // one-shot one runs out by itself
+   if(ret == HRTIMER_RESTART && (wave->flags & GD_WAVE_REPEAT) && wave->next <= now)
+   {
+      wave->next += (div64_u64(now - wave->next, wave->period) + 1) * wave->period;
+   }
+
+   if(ret == HRTIMER_RESTART)
+   {
+      hrtimer_set_expires(timer, ns_to_ktime(wave->next));
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   return ret;
+}
+
+static u64 gd_board_wave_period(const struct gd_inject_step *steps, unsigned int count)
+{
+   u64 period = 0;
+   unsigned int i;
+
+   for(i = 0; i < count; i++)
+   {
+      period += steps[i].delay_ns;
+   }
+
+   return period;
+}
+
+static bool gd_board_wave_valid(const struct gd_inject_step *steps, unsigned int count, u32 flags)
+{
+   // a loop much tighter than a timer tick would never leave the timer
+   return count && !(flags & ~GD_WAVE_REPEAT) &&
+      (!(flags & GD_WAVE_REPEAT) || gd_board_wave_period(steps, count) >= GD_WAVE_MIN_PERIOD_NS);
+}
+
+/* start playing count steps, the board owns them from here on (kvmalloc'd) */
+int gd_board_wave_start(struct gd_board *board, struct gd_inject_step *steps, unsigned int count, u32 flags, u64 slack)
+{
+   struct gd_wave_state *wave = &board->wave;
+   unsigned long irqflags;
+
+   if(!gd_board_wave_valid(steps, count, flags))
+   {
+      kvfree(steps);
+      return -EINVAL;
+   }
+
+   mutex_lock(&wave->lock);
+
+   gd_board_wave_stop_locked(board);
+
+   spin_lock_irqsave(&board->lock, irqflags);
+   wave->steps = steps;
+   wave->count = count;
+   wave->pos = 0;
+   wave->flags = flags;
+   wave->slack = slack;
+   wave->period = gd_board_wave_period(steps, count);
+   wave->next = ktime_get_ns() + steps[0].delay_ns;
+   spin_unlock_irqrestore(&board->lock, irqflags);
+
+   hrtimer_start(&wave->timer, ns_to_ktime(wave->next), HRTIMER_MODE_ABS);
+
+   mutex_unlock(&wave->lock);
+
+   return 0;
+}
+
+static void gd_board_wave_stop_locked(struct gd_board *board)
+{
+   struct gd_wave_state *wave = &board->wave;
+   struct gd_inject_step *steps = NULL;
+   unsigned long flags;
+
+   hrtimer_cancel(&wave->timer);
+
+   spin_lock_irqsave(&board->lock, flags);
+   steps = wave->steps;
+   wave->steps = NULL;
+   wave->count = 0;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   kvfree(steps);
+}
+
+void gd_board_wave_stop(struct gd_board *board)
+{
+   mutex_lock(&board->wave.lock);
+   gd_board_wave_stop_locked(board);
+   mutex_unlock(&board->wave.lock);
+}
+
+void gd_watch_init(struct gd_watch *watch)
+{
+   memset(watch, 0, sizeof(*watch));
+   INIT_LIST_HEAD(&watch->list);
+   init_waitqueue_head(&watch->wait);
+}
+
+static void gd_board_watch_mask_locked(struct gd_board *board)
+{
+   struct gd_watch *watch = NULL;
+   u64 mask = 0;
+
+   list_for_each_entry(watch, &board->watches, list)
+   {
+      mask |= watch->mask;
+   }
+
+   board->watch_mask = mask;
+}
+
+void gd_board_watch_add(struct gd_board *board, struct gd_watch *watch)
+{
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+   list_add(&watch->list, &board->watches);
+   gd_board_watch_mask_locked(board);
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+void gd_board_watch_del(struct gd_board *board, struct gd_watch *watch)
+{
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+   list_del_init(&watch->list);
+   gd_board_watch_mask_locked(board);
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+void gd_board_watch_set(struct gd_board *board, struct gd_watch *watch, u64 mask)
+{
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+   watch->mask = mask & GD_ALL_PINS;
+   watch->changed &= watch->mask;
+   if(!watch->changed)
+   {
+      watch->count = 0;
+   }
+   gd_board_watch_mask_locked(board);
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+void gd_board_watch_read(struct gd_board *board, struct gd_watch *watch, struct gd_watch_event *ev)
+{
+   unsigned long flags;
+
+   spin_lock_irqsave(&board->lock, flags);
+   ev->changed = watch->changed;
+   ev->count = watch->count;
+   ev->level = board->level;
+   watch->changed = 0;
+   watch->count = 0;
+   spin_unlock_irqrestore(&board->lock, flags);
+}
+
+/* reads and writes never block, pending changes show up as POLLPRI */
+__poll_t gd_board_watch_poll(struct gd_board *board, struct gd_watch *watch, struct file *filep, poll_table *pt)
+{
+   __poll_t mask = EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+   poll_wait(filep, &watch->wait, pt);
+
+   if(READ_ONCE(watch->count))
+   {
+      mask |= EPOLLPRI;
+   }
+
+   return mask;
+}
+
+static void gd_board_evfd_mask_locked(struct gd_board *board)
+{
+   struct gd_evfd *evfd = NULL;
+   u64 mask = 0;
+
+   list_for_each_entry(evfd, &board->evfds, list)
+   {
+      mask |= evfd->mask;
+   }
+
+   board->evfd_mask = mask;
+}
+
+int gd_board_evfd_add(struct gd_board *board, int fd, u64 mask, u32 edges, void *owner)
+{
+   struct gd_evfd *evfd = NULL;
+   struct eventfd_ctx *ctx = NULL;
+   unsigned long flags;
+
+   if(!edges || (edges & ~GD_EDGE_BOTH) || !(mask & GD_ALL_PINS))
+   {
+      return -EINVAL;
+   }
+
+   ctx = eventfd_ctx_fdget(fd);
+   if(IS_ERR(ctx))
+   {
+      return PTR_ERR(ctx);
+   }
+
+   evfd = kzalloc(sizeof(*evfd), GFP_KERNEL);
+   if(!evfd)
+   {
+      eventfd_ctx_put(ctx);
+      return -ENOMEM;
+   }
+
+   evfd->ctx = ctx;
+   evfd->mask = mask & GD_ALL_PINS;
+   evfd->edges = edges;
+   evfd->owner = owner;
+
+   spin_lock_irqsave(&board->lock, flags);
+   list_add_tail(&evfd->list, &board->evfds);
+   board->evfd_mask |= evfd->mask;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   return 0;
+}
+
+static void gd_board_evfd_free_list(struct list_head *list)
+{
+   struct gd_evfd *evfd = NULL;
+   struct gd_evfd *tmp = NULL;
+
+   list_for_each_entry_safe(evfd, tmp, list, list)
+   {
+      list_del(&evfd->list);
+      eventfd_ctx_put(evfd->ctx);
+      kfree(evfd);
+   }
+}
+
+/* drop owner's bindings of fd, -ENOENT if there were none */
+int gd_board_evfd_del(struct gd_board *board, int fd, void *owner)
+{
+   struct gd_evfd *evfd = NULL;
+   struct gd_evfd *tmp = NULL;
+   struct eventfd_ctx *ctx = NULL;
+   unsigned long flags;
+   LIST_HEAD(dead);
+
+   ctx = eventfd_ctx_fdget(fd);
+   if(IS_ERR(ctx))
+   {
+      return PTR_ERR(ctx);
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+   list_for_each_entry_safe(evfd, tmp, &board->evfds, list)
+   {
+      if(evfd->owner == owner && evfd->ctx == ctx)
+      {
+         list_move(&evfd->list, &dead);
+      }
+   }
+   gd_board_evfd_mask_locked(board);
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   eventfd_ctx_put(ctx);
+
+   if(list_empty(&dead))
+   {
+      return -ENOENT;
+   }
+
+   gd_board_evfd_free_list(&dead);
+   return 0;
+}
+
+void gd_board_evfd_del_owner(struct gd_board *board, void *owner)
+{
+   struct gd_evfd *evfd = NULL;
+   struct gd_evfd *tmp = NULL;
+   unsigned long flags;
+   LIST_HEAD(dead);
+
+   spin_lock_irqsave(&board->lock, flags);
+   list_for_each_entry_safe(evfd, tmp, &board->evfds, list)
+   {
+      if(evfd->owner == owner)
+      {
+         list_move(&evfd->list, &dead);
+      }
+   }
+   gd_board_evfd_mask_locked(board);
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   gd_board_evfd_free_list(&dead);
+}
+
+/* a client is about to access the register at off through its mapping */
+void gd_board_trap_begin(struct gd_board *board, unsigned int off, bool write)
+{
+   bool read = !write && gd_board_reg_valid(off);
+   bool backend = false;
+   unsigned long flags;
+   u32 val = 0;
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   gd_board_sample_locked(board);
+   gd_board_sync_page_locked(board);
+
+   if(read && (off == GD_GPLEV0 || off == GD_GPLEV0 + 4) &&
+      gd_replay_pop_locked(&board->replay, off, &val))
+   {
+      WRITE_ONCE(board->page[off / 4], val);
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   if(!read)
+   {
+      return;
+   }
+
+   gd_stats_access(&board->stats, off, false);
+
+   // a backend register reads whatever the backend says. if it doesn't
+   // answer the model's value stands
+   backend = gd_backend_claims(&board->backend, off) && gd_backend_read(&board->backend, off, &val) == 0;
+
+   if(backend || gd_record_active(&board->record))
+   {
+      spin_lock_irqsave(&board->lock, flags);
+
+      if(backend)
+      {
+         WRITE_ONCE(board->page[off / 4], val);
+      }
+
+      gd_record_access_locked(&board->record, gd_board_time(board), off, READ_ONCE(board->page[off / 4]), false, current);
+
+      spin_unlock_irqrestore(&board->lock, flags);
+   }
+
+   if(gd_relay_enabled(&board->relay))
+   {
+      gd_relay_access(&board->relay, off, READ_ONCE(board->page[off / 4]), false, current);
+   }
+
+   if(trace_gd_access_enabled())
+   {
+      gd_board_trace_access(board, off, READ_ONCE(board->page[off / 4]), false, current);
+   }
+}
+
+/* the access task made has executed. val is what a write stored, decoded by
+ * the caller, the page itself may have been resynced since. task isn't current
+ * when the site work finishes an access whose uprobe wasn't in yet */
+void gd_board_trap_end(struct gd_board *board, unsigned int off, bool write, u32 val, struct task_struct *task)
+{
+   unsigned long flags;
+
+   if(!write || !gd_board_reg_valid(off))
+   {
+      return;
+   }
+
+   gd_stats_access(&board->stats, off, true);
+
+   if(gd_relay_enabled(&board->relay))
+   {
+      gd_relay_access(&board->relay, off, val, true, task);
+   }
+
+   if(trace_gd_access_enabled())
+   {
+      gd_board_trace_access(board, off, val, true, task);
+   }
+
+   if(gd_backend_claims(&board->backend, off) && gd_backend_write(&board->backend, off, val, task) == 0)
+   {
+      if(gd_record_active(&board->record))
+      {
+         spin_lock_irqsave(&board->lock, flags);
+         gd_record_access_locked(&board->record, gd_board_time(board), off, val, true, task);
+         spin_unlock_irqrestore(&board->lock, flags);
+      }
+
+      return;
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(gd_record_active(&board->record))
+   {
+      gd_record_access_locked(&board->record, gd_board_time(board), off, val, true, task);
+   }
+
+   gd_board_write_reg_locked(board, off, val, 0);
+   gd_board_update_locked(board);
+   gd_board_sync_page_locked(board);
+
+   spin_unlock_irqrestore(&board->lock, flags);
+}
@@ -0,0 +1,197 @@
+#ifndef GPIOMEM_DUMMY_BOARD_H_GUARD
+#define GPIOMEM_DUMMY_BOARD_H_GUARD
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/mm_types.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/sched.h>
+#include <linux/pid_namespace.h>
+
+#include "gpiomem_dummy_ioctl.h"
+#include "gpiomem_dummy_backend.h"
+#include "gpiomem_dummy_record.h"
+#include "gpiomem_dummy_vcd.h"
+#include "gpiomem_dummy_relay.h"
+#include "gpiomem_dummy_stats.h"
+
+/* bcm283x gpio registers, offsets into the gpio block. the ones with two
+ * banks cover pins 0-31 in the first word and 32-53 in the second */
+#define GD_GPFSEL0   0x00
+#define GD_GPFSEL5   0x14
+#define GD_GPSET0    0x1c
+#define GD_GPCLR0    0x28
+#define GD_GPLEV0    0x34
+#define GD_GPEDS0    0x40
+#define GD_GPREN0    0x4c
+#define GD_GPFEN0    0x58
+#define GD_GPHEN0    0x64
+#define GD_GPLEN0    0x70
+#define GD_GPAREN0   0x7c
+#define GD_GPAFEN0   0x88
+#define GD_GPPUD     0x94
+#define GD_GPPUDCLK0 0x98
+
+#define GD_NUM_REGS (0xb4 / 4) // BCM283X_GPIO_SIZE in words
+#define GD_NUM_PINS 54
+#define GD_ALL_PINS ((1ULL << GD_NUM_PINS) - 1)
+
+#define GD_FSEL_INPUT  0
+#define GD_FSEL_OUTPUT 1
+
+/* someone waiting on pin changes, one per open file */
+struct gd_watch
+{
+   struct list_head list; // board->watches
+   wait_queue_head_t wait;
+   u64 mask; // pins of interest
+   u64 changed; // changes since the last read, under board->lock
+   u64 count;
+};
+
+/* an eventfd bound to pins */
+struct gd_evfd
+{
+   struct list_head list; // board->evfds
+   struct eventfd_ctx *ctx;
+   u64 mask;
+   u32 edges; // GD_EDGE_*
+   void *owner; // who to drop it with
+};
+
+/* a waveform being played into the inputs */
+struct gd_wave_state
+{
+   struct mutex lock; // serializes start/stop, the rest is under board->lock
+   struct hrtimer timer; // not _HARD, the tick takes board->lock and signals eventfds
+   struct gd_inject_step *steps; // NULL when idle
+   unsigned int count;
+   unsigned int pos; // next step
+   u32 flags; // GD_WAVE_*
+   u64 slack;
+   u64 period; // sum of the delays, one loop of a repeating wave
+   u64 next; // ktime_get_ns() time steps[pos] is due
+};
+
+/* the emulated gpio block. pin state is kept as 64 bit words (bit n = pin n)
+ * and the two register banks are just views of them */
+struct gd_board
+{
+   spinlock_t lock; // always taken irqsave
+
+   u32 regs[GD_NUM_REGS]; // plain read/write registers (GPFSEL, GPREN, ...)
+   u64 outputs; // pins GPFSEL has set to output
+   u64 out; // output latch, driven by GPSET/GPCLR
+   u64 in; // externally driven input levels
+   u64 level; // what GPLEV reads back
+   u64 eds; // event detect status, GPEDS
+
+   u64 wire[GD_NUM_PINS]; // per output pin, the inputs it's wired to
+   u64 wire_src; // pins with a non-empty wire[]
+
+   struct list_head models; // attached gd_model's
+   u64 model_mask; // union of their pins
+   u64 model_drives; // union of the inputs they drive
+   bool model_dirty; // a model drove something, settle again
+
+   struct list_head watches; // gd_watch's
+   u64 watch_mask; // union of the watch masks, so idle pins cost one AND
+   struct list_head evfds; // gd_evfd's
+   u64 evfd_mask; // same for the eventfds
+
+   u64 epoch; // ktime_get_ns() at board time 0
+
+   u32 *page; // kernel address of the page clients have mapped
+   struct gd_ctrl_page *ctrl; // harness control page
+   u32 ctrl_seq; // last control page seq applied
+
+   struct gd_wave_state wave;
+
+   struct gd_backend backend; // userspace model, if one is attached
+
+   struct gd_record record;
+   struct gd_replay replay;
+   struct gd_vcd vcd;
+   struct gd_relay relay;
+   struct gd_stats stats;
+};
+
+/* who's touching the registers. the harness side (read/write on the cdev)
+ * can drive inputs through GPLEV, a client write there is ignored like on
+ * the real thing */
+#define GD_ACCESS_HARNESS 0x1
+
+void gd_board_init(struct gd_board *board, struct page *page, struct page *ctrl_page);
+void gd_board_destroy(struct gd_board *board);
+void gd_board_reset(struct gd_board *board);
+int gd_board_save(struct gd_board *board, struct gd_snapshot *snap, struct gd_inject_step *steps, unsigned int room);
+int gd_board_restore(struct gd_board *board, const struct gd_snapshot *snap, struct gd_inject_step *steps);
+
+u64 gd_board_output_mask(struct gd_board *board);
+
+u32 gd_board_read_reg_locked(struct gd_board *board, unsigned int off);
+void gd_board_write_reg_locked(struct gd_board *board, unsigned int off, u32 val, unsigned int flags);
+void gd_board_update_locked(struct gd_board *board);
+void gd_board_sync_page_locked(struct gd_board *board);
+
+void gd_board_read_regs(struct gd_board *board, unsigned int off, u32 *buf, unsigned int count);
+void gd_board_write_regs(struct gd_board *board, unsigned int off, const u32 *buf, unsigned int count, unsigned int flags);
+
+int gd_board_wire(struct gd_board *board, unsigned int src, u64 dst);
+void gd_board_unwire(struct gd_board *board);
+
+void gd_board_set_inputs_locked(struct gd_board *board, u64 pins, u64 levels);
+void gd_board_sample_locked(struct gd_board *board);
+int gd_board_inject(struct gd_board *board, const struct gd_inject_step *steps, unsigned int count, u64 *deadline);
+
+int gd_board_wave_start(struct gd_board *board, struct gd_inject_step *steps, unsigned int count, u32 flags, u64 slack);
+void gd_board_wave_stop(struct gd_board *board);
+
+void gd_watch_init(struct gd_watch *watch);
+void gd_board_watch_add(struct gd_board *board, struct gd_watch *watch);
+void gd_board_watch_del(struct gd_board *board, struct gd_watch *watch);
+void gd_board_watch_set(struct gd_board *board, struct gd_watch *watch, u64 mask);
+void gd_board_watch_read(struct gd_board *board, struct gd_watch *watch, struct gd_watch_event *ev);
+__poll_t gd_board_watch_poll(struct gd_board *board, struct gd_watch *watch, struct file *filep, poll_table *pt);
+
+int gd_board_evfd_add(struct gd_board *board, int fd, u64 mask, u32 edges, void *owner);
+int gd_board_evfd_del(struct gd_board *board, int fd, void *owner);
+void gd_board_evfd_del_owner(struct gd_board *board, void *owner);
+
+void gd_board_trap_begin(struct gd_board *board, unsigned int off, bool write);
+void gd_board_trap_end(struct gd_board *board, unsigned int off, bool write, u32 val, struct task_struct *task);
+
+/* board time, what snapshots and traces are stamped with */
+static inline
+u64 gd_board_time(struct gd_board *board)
+{
+   return ktime_get_ns() - READ_ONCE(board->epoch);
+}
+
+/* task's ids as its own pid namespace has them, also when called from a
+ * worker on its behalf */
+static inline
+pid_t gd_task_tid(struct task_struct *task)
+{
+   return task_pid_nr_ns(task, task_active_pid_ns(task));
+}
+
+static inline
+pid_t gd_task_tgid(struct task_struct *task)
+{
+   return task_tgid_nr_ns(task, task_active_pid_ns(task));
+}
+
+static inline
+bool gd_board_reg_valid(unsigned int off)
+{
+   return off < GD_NUM_REGS * 4 && !(off & 3);
+}
+
+#endif /* GPIOMEM_DUMMY_BOARD_H_GUARD */
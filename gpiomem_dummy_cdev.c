@@ -7,35 +7,79 @@
 #include <linux/mm.h>
 #include <linux/cdev.h>
 #include <linux/errno.h>
-#include <asm-generic/pgtable.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
 
 #include "gpiomem_dummy_log.h"
 
 #include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
 #include "gpiomem_dummy_mmap.h"
+#include "gpiomem_dummy_ioctl.h"
 #include <linux/mman.h>
 
 static int gd_cdev_open(struct inode *inodep, struct file *filep);
 static int gd_cdev_mmap(struct file* file, struct vm_area_struct* vma);
 static int gd_cdev_release(struct inode *inodep, struct file *filep);
 
-static ssize_t gd_cdev_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t gd_cdev_write(struct file *, const char __user *, size_t, loff_t *);
+static loff_t gd_cdev_llseek(struct file *filep, loff_t offset, int whence);
+static ssize_t gd_cdev_read_iter(struct kiocb *iocb, struct iov_iter *to);
+static ssize_t gd_cdev_write_iter(struct kiocb *iocb, struct iov_iter *from);
+static long gd_cdev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg);
+static __poll_t gd_cdev_poll(struct file *filep, poll_table *pt);
+
+/* per open file state */
+struct gd_cdev_file
+{
+   struct gpiomem_dummy *gd;
+   struct gd_watch watch;
+};
 
 /** @brief Devices are represented as file structure in the kernel. The file_operations structure from
  *  /linux/fs.h lists the callback functions that you wish to associated with your file operations
  *  using a C99 syntax structure. char devices usually implement open, read, write and release calls
  */
-static struct file_operations gd_cdev_fops =
+static const struct file_operations gd_cdev_fops =
 {
    .owner = THIS_MODULE,
    .open = gd_cdev_open,
    .release = gd_cdev_release,
    .mmap = gd_cdev_mmap,
-   .llseek = no_llseek,
-   .read = gd_cdev_read,
-   .write = gd_cdev_write,
+   .llseek = gd_cdev_llseek,
+   .read_iter = gd_cdev_read_iter, // read, pread, readv, preadv
+   .write_iter = gd_cdev_write_iter, // write, pwrite, writev, pwritev
+   .unlocked_ioctl = gd_cdev_ioctl,
+   .compat_ioctl = compat_ptr_ioctl, // the structs are the same size everywhere
+   .poll = gd_cdev_poll,
+};
+
+/* echo 1 > /sys/class/gpiomem/gpiomem/reset, same as GD_IOC_RESET */
+static ssize_t reset_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+   struct gpiomem_dummy_cdev *cdev = dev_get_drvdata(dev);
+   bool doit = false;
+
+   if(kstrtobool(buf, &doit) != 0)
+   {
+      return -EINVAL;
+   }
+
+   if(doit)
+   {
+      gd_reset(gd_cdev_get_dummy(cdev));
+   }
+
+   return count;
+}
+static DEVICE_ATTR_WO(reset);
+
+static struct attribute *gd_cdev_attrs[] = {
+   &dev_attr_reset.attr,
+   NULL,
 };
+ATTRIBUTE_GROUPS(gd_cdev);
 
 int gd_cdev_init(struct gpiomem_dummy_cdev *cdev)
 {
@@ -64,12 +108,12 @@ int gd_cdev_init(struct gpiomem_dummy_cdev *cdev)
    dev_id = MKDEV(cdev_major, 0);
 
    // register our class/device so the kernel will auto create /dev entries
-   clss = class_create(THIS_MODULE, CLASS_NAME);
+   clss = gd_class_create(CLASS_NAME);
    check_error_cleanup(clss, "failed to create class");
 
    pr_info("registered device class");
 
-   dev = device_create(clss, NULL, dev_id, cdev, DEVICE_NAME);
+   dev = device_create_with_groups(clss, NULL, dev_id, cdev, gd_cdev_groups, DEVICE_NAME);
    check_error_cleanup(dev, "failed to create device");
 
    cdevp = &cdev->cdev;
@@ -143,11 +187,16 @@ inline static struct gpiomem_dummy_cdev *inode_to_cdev(struct inode *ip)
    return container_of(ip->i_cdev, struct gpiomem_dummy_cdev, cdev);
 }
 
-inline static struct gpiomem_dummy *file_to_gd(struct file *fp)
+inline static struct gd_cdev_file *file_to_cfile(struct file *fp)
 {
    return fp->private_data;
 }
 
+inline static struct gpiomem_dummy *file_to_gd(struct file *fp)
+{
+   return file_to_cfile(fp)->gd;
+}
+
 /** @brief The device open function that is called each time the device is opened
  *  This will only increment the numberOpens counter in this case.
  *  @param inodep A pointer to an inode object (defined in linux/fs.h)
@@ -156,19 +205,32 @@ inline static struct gpiomem_dummy *file_to_gd(struct file *fp)
 static int gd_cdev_open(struct inode *inodep, struct file *filep)
 {
    struct gpiomem_dummy_cdev *cdev = inode_to_cdev(inodep);
+   struct gd_cdev_file *cfile = NULL;
+
    if(!cdev)
    {
       pr_err("cdev not found?!");
       return -ENODEV;
    }
 
-   filep->private_data = gd_cdev_get_dummy(cdev);
+   cfile = kzalloc(sizeof(*cfile), GFP_KERNEL);
+   if(!cfile)
+   {
+      return -ENOMEM;
+   }
+
+   cfile->gd = gd_cdev_get_dummy(cdev);
+   gd_watch_init(&cfile->watch);
+   gd_board_watch_add(&cfile->gd->board, &cfile->watch);
+
+   filep->private_data = cfile;
 
    cdev->times_opened++;
 
    pr_info("device has been opened %d time(s)", cdev->times_opened);
 
-   return nonseekable_open(inodep, filep);
+   // file offsets are register offsets into the gpio block, so pread/pwrite work
+   return 0;
 }
 
 static int gd_cdev_mmap(struct file* fp, struct vm_area_struct* vma)
@@ -212,10 +274,26 @@ static int gd_cdev_mmap(struct file* fp, struct vm_area_struct* vma)
 
    vma->vm_private_data = gd;
 
+   if (vma->vm_pgoff == GD_CTRL_PGOFF)
+   {
+      return gd_mmap_ctrl(vma);
+   }
+
+   if (vma->vm_pgoff == GD_RING_PGOFF)
+   {
+      return gd_backend_mmap(&gd->board.backend, vma, file_to_cfile(fp));
+   }
+
    vma->vm_ops = &gpiomem_dummy_mmap_vmops;
 
    vma->vm_ops->open(vma);
 
+   if (gd_mmap_populate(vma) != 0)
+   {
+      pr_err("failed to populate mapping");
+      return -ENOMEM;
+   }
+
    pr_info("mmap success!");
 
    // gd_cdev_mmap_open(vma); <-- is it really necessary to call the mmap open function here if we have one set up?? I'd think it's already been called....
@@ -230,19 +308,431 @@ static int gd_cdev_mmap(struct file* fp, struct vm_area_struct* vma)
  */
 static int gd_cdev_release(struct inode *inodep, struct file *filep)
 {
+   struct gd_cdev_file *cfile = file_to_cfile(filep);
+
+   gd_board_watch_del(&cfile->gd->board, &cfile->watch);
+   gd_board_evfd_del_owner(&cfile->gd->board, cfile);
+   gd_backend_detach(&cfile->gd->board.backend, cfile);
+   kfree(cfile);
+
    pr_info("Device successfully closed");
    return 0;
 }
 
-static ssize_t gd_cdev_read(struct file *filp, char __user *data, size_t len, loff_t *offset)
+static loff_t gd_cdev_llseek(struct file *filep, loff_t offset, int whence)
+{
+   return fixed_size_llseek(filep, offset, whence, BCM283X_GPIO_SIZE);
+}
+
+/* clamp an access at pos to the register file. accesses are whole registers */
+static ssize_t gd_cdev_reg_span(loff_t pos, size_t len)
+{
+   if((pos & 3) || (len & 3))
+   {
+      return -EINVAL;
+   }
+
+   if(pos >= BCM283X_GPIO_SIZE)
+   {
+      return 0;
+   }
+
+   return min_t(size_t, len, BCM283X_GPIO_SIZE - pos);
+}
+
+/* read the register file at the file offset. the whole request (every iovec
+ * of a readv included) is one consistent snapshot */
+static ssize_t gd_cdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+   struct gpiomem_dummy *gd = file_to_gd(iocb->ki_filp);
+   u32 regs[GD_NUM_REGS];
+   ssize_t len = gd_cdev_reg_span(iocb->ki_pos, iov_iter_count(to));
+   size_t copied = 0;
+
+   if(len <= 0)
+   {
+      return len;
+   }
+
+   gd_board_read_regs(&gd->board, iocb->ki_pos, regs, len / 4);
+
+   copied = copy_to_iter(regs, len, to);
+   if(!copied)
+   {
+      return -EFAULT;
+   }
+
+   iocb->ki_pos += copied;
+
+   return copied;
+}
+
+/* write the register file at the file offset, applied as one step. this is
+ * the harness side, so writing GPLEV drives the input levels */
+static ssize_t gd_cdev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+   struct gpiomem_dummy *gd = file_to_gd(iocb->ki_filp);
+   u32 regs[GD_NUM_REGS];
+   ssize_t len = gd_cdev_reg_span(iocb->ki_pos, iov_iter_count(from));
+   size_t copied = 0;
+
+   if(len <= 0)
+   {
+      return len ? len : -ENOSPC;
+   }
+
+   copied = copy_from_iter(regs, len, from) & ~3;
+   if(!copied)
+   {
+      return -EFAULT;
+   }
+
+   gd_board_write_regs(&gd->board, iocb->ki_pos, regs, copied / 4, GD_ACCESS_HARNESS);
+
+   iocb->ki_pos += copied;
+
+   return copied;
+}
+
+// inject steps are copied in from userspace a page at a time
+#define GD_INJECT_CHUNK (PAGE_SIZE / sizeof(struct gd_inject_step))
+
+static long gd_cdev_inject(struct gpiomem_dummy *gd, struct gd_inject __user *argp)
+{
+   struct gd_inject req;
+   struct gd_inject_step __user *usteps = NULL;
+   struct gd_inject_step *steps = NULL;
+   unsigned int done = 0;
+   u64 deadline = 0;
+   long ret = 0;
+
+   if(copy_from_user(&req, argp, sizeof(req)))
+   {
+      return -EFAULT;
+   }
+
+   if(req.flags || req.count > INT_MAX)
+   {
+      return -EINVAL;
+   }
+
+   steps = kmalloc(GD_INJECT_CHUNK * sizeof(*steps), GFP_KERNEL);
+   if(!steps)
+   {
+      return -ENOMEM;
+   }
+
+   usteps = u64_to_user_ptr(req.steps);
+   deadline = ktime_get_ns();
+
+   while(done < req.count)
+   {
+      unsigned int n = min_t(unsigned int, req.count - done, GD_INJECT_CHUNK);
+
+      if(copy_from_user(steps, usteps + done, n * sizeof(*steps)))
+      {
+         ret = -EFAULT;
+         break;
+      }
+
+      ret = gd_board_inject(&gd->board, steps, n, &deadline);
+      if(ret < 0)
+      {
+         break;
+      }
+
+      done += ret;
+      if(ret < n)
+      {
+         break;
+      }
+   }
+
+   kfree(steps);
+
+   return done ? done : ret;
+}
+
+static long gd_cdev_wave(struct gpiomem_dummy *gd, struct gd_wave __user *argp)
+{
+   struct gd_wave req;
+   struct gd_inject_step *steps = NULL;
+
+   if(copy_from_user(&req, argp, sizeof(req)))
+   {
+      return -EFAULT;
+   }
+
+   if(!req.count || req.count > GD_WAVE_MAX_STEPS)
+   {
+      return -EINVAL;
+   }
+
+   steps = kvmalloc_array(req.count, sizeof(*steps), GFP_KERNEL);
+   if(!steps)
+   {
+      return -ENOMEM;
+   }
+
+   if(copy_from_user(steps, u64_to_user_ptr(req.steps), req.count * sizeof(*steps)))
+   {
+      kvfree(steps);
+      return -EFAULT;
+   }
+
+   // takes steps, even on failure
+   return gd_board_wave_start(&gd->board, steps, req.count, req.flags, req.slack_ns);
+}
+
+static long gd_cdev_wire(struct gpiomem_dummy *gd, struct gd_wire __user *argp)
+{
+   struct gd_wire req;
+
+   if(copy_from_user(&req, argp, sizeof(req)))
+   {
+      return -EFAULT;
+   }
+
+   if(req.flags)
+   {
+      return -EINVAL;
+   }
+
+   return gd_board_wire(&gd->board, req.src, req.dst);
+}
+
+static long gd_cdev_backend_attach(struct gd_cdev_file *cfile, struct gd_backend_attach __user *argp)
+{
+   struct gd_backend_attach req;
+
+   if(copy_from_user(&req, argp, sizeof(req)))
+   {
+      return -EFAULT;
+   }
+
+   if(req.flags)
+   {
+      return -EINVAL;
+   }
+
+   return gd_backend_attach(&cfile->gd->board.backend, req.regs, cfile);
+}
+
+static long gd_cdev_snapshot(struct gpiomem_dummy *gd, struct gd_snapshot __user *argp)
+{
+   struct gd_snapshot *snap = NULL;
+   struct gd_inject_step *steps = NULL;
+   unsigned int room = 0;
+   u64 usteps = 0;
+   long ret = 0;
+
+   snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+   if(!snap)
+   {
+      return -ENOMEM;
+   }
+
+   if(copy_from_user(snap, argp, sizeof(*snap)))
+   {
+      ret = -EFAULT;
+      goto out;
+   }
+
+   usteps = snap->wave_steps;
+   room = min_t(unsigned int, snap->wave_count, GD_WAVE_MAX_STEPS);
+   if(room)
+   {
+      steps = kvmalloc_array(room, sizeof(*steps), GFP_KERNEL);
+      if(!steps)
+      {
+         ret = -ENOMEM;
+         goto out;
+      }
+   }
+
+   ret = gd_board_save(&gd->board, snap, steps, room);
+   snap->wave_steps = usteps;
+
+   if(ret == -ENOSPC)
+   {
+      // just tell them how much room it takes
+      if(put_user(snap->wave_count, &argp->wave_count))
+      {
+         ret = -EFAULT;
+      }
+   }
+   else if(ret == 0)
+   {
+      if((snap->wave_count &&
+          copy_to_user(u64_to_user_ptr(usteps), steps, snap->wave_count * sizeof(*steps))) ||
+         copy_to_user(argp, snap, sizeof(*snap)))
+      {
+         ret = -EFAULT;
+      }
+   }
+
+out:
+   kvfree(steps);
+   kfree(snap);
+   return ret;
+}
+
+static long gd_cdev_restore(struct gpiomem_dummy *gd, struct gd_snapshot __user *argp)
+{
+   struct gd_snapshot *snap = NULL;
+   struct gd_inject_step *steps = NULL;
+   long ret = 0;
+
+   snap = kmalloc(sizeof(*snap), GFP_KERNEL);
+   if(!snap)
+   {
+      return -ENOMEM;
+   }
+
+   if(copy_from_user(snap, argp, sizeof(*snap)))
+   {
+      ret = -EFAULT;
+      goto out;
+   }
+
+   if(snap->wave_count > GD_WAVE_MAX_STEPS)
+   {
+      ret = -EINVAL;
+      goto out;
+   }
+
+   if(snap->wave_count)
+   {
+      steps = kvmalloc_array(snap->wave_count, sizeof(*steps), GFP_KERNEL);
+      if(!steps)
+      {
+         ret = -ENOMEM;
+         goto out;
+      }
+
+      if(copy_from_user(steps, u64_to_user_ptr(snap->wave_steps), snap->wave_count * sizeof(*steps)))
+      {
+         kvfree(steps);
+         ret = -EFAULT;
+         goto out;
+      }
+   }
+
+   // takes steps, even on failure
+   ret = gd_board_restore(&gd->board, snap, steps);
+
+out:
+   kfree(snap);
+   return ret;
+}
+
+static long gd_cdev_watch_set(struct gd_cdev_file *cfile, u64 __user *argp)
+{
+   u64 mask = 0;
+
+   if(get_user(mask, argp))
+   {
+      return -EFAULT;
+   }
+
+   gd_board_watch_set(&cfile->gd->board, &cfile->watch, mask);
+
+   return 0;
+}
+
+static long gd_cdev_watch_read(struct gd_cdev_file *cfile, struct gd_watch_event __user *argp)
+{
+   struct gd_watch_event ev;
+
+   gd_board_watch_read(&cfile->gd->board, &cfile->watch, &ev);
+
+   return copy_to_user(argp, &ev, sizeof(ev)) ? -EFAULT : 0;
+}
+
+static long gd_cdev_eventfd(struct gd_cdev_file *cfile, unsigned int cmd, struct gd_eventfd __user *argp)
 {
-   pr_info("read!");
+   struct gd_eventfd req;
 
-   return len;
+   if(copy_from_user(&req, argp, sizeof(req)))
+   {
+      return -EFAULT;
+   }
+
+   if(cmd == GD_IOC_EVENTFD_DEL)
+   {
+      return gd_board_evfd_del(&cfile->gd->board, req.fd, cfile);
+   }
+
+   return gd_board_evfd_add(&cfile->gd->board, req.fd, req.mask, req.edges, cfile);
+}
+
+static __poll_t gd_cdev_poll(struct file *filep, poll_table *pt)
+{
+   struct gd_cdev_file *cfile = file_to_cfile(filep);
+
+   return gd_board_watch_poll(&cfile->gd->board, &cfile->watch, filep, pt);
 }
 
-static ssize_t gd_cdev_write(struct file *filp, const char __user *data, size_t len, loff_t *offset)
+static long gd_cdev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
 {
-   pr_info("write!");
-   return len;
+   struct gd_cdev_file *cfile = file_to_cfile(filep);
+   struct gpiomem_dummy *gd = cfile->gd;
+   void __user *argp = (void __user *)arg;
+
+   switch(cmd)
+   {
+      case GD_IOC_INJECT:
+         return gd_cdev_inject(gd, argp);
+
+      case GD_IOC_WAVE_START:
+         return gd_cdev_wave(gd, argp);
+
+      case GD_IOC_WAVE_STOP:
+         gd_board_wave_stop(&gd->board);
+         return 0;
+
+      case GD_IOC_WIRE_SET:
+         return gd_cdev_wire(gd, argp);
+
+      case GD_IOC_WIRE_CLEAR:
+         gd_board_unwire(&gd->board);
+         return 0;
+
+      case GD_IOC_BACKEND_ATTACH:
+         return gd_cdev_backend_attach(cfile, argp);
+
+      case GD_IOC_BACKEND_DETACH:
+         gd_backend_detach(&gd->board.backend, cfile);
+         return 0;
+
+      case GD_IOC_BACKEND_WAIT:
+         return gd_backend_wait(&gd->board.backend, cfile);
+
+      case GD_IOC_BACKEND_KICK:
+         gd_backend_kick(&gd->board.backend, cfile);
+         return 0;
+
+      case GD_IOC_RESET:
+         gd_reset(gd);
+         return 0;
+
+      case GD_IOC_SNAPSHOT:
+         return gd_cdev_snapshot(gd, argp);
+
+      case GD_IOC_RESTORE:
+         return gd_cdev_restore(gd, argp);
+
+      case GD_IOC_WATCH_SET:
+         return gd_cdev_watch_set(cfile, argp);
+
+      case GD_IOC_WATCH_READ:
+         return gd_cdev_watch_read(cfile, argp);
+
+      case GD_IOC_EVENTFD_ADD:
+      case GD_IOC_EVENTFD_DEL:
+         return gd_cdev_eventfd(cfile, cmd, argp);
+
+      default:
+         return -ENOTTY;
+   }
 }
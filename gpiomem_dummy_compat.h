@@ -0,0 +1,231 @@
+#ifndef GPIOMEM_DUMMY_COMPAT_H_GUARD
+#define GPIOMEM_DUMMY_COMPAT_H_GUARD
+
+/* papers over the kernel api changes between the 4.16 tree this was written
+ * against and current kernels, so the rest of the code can use the new names */
+
+#include <linux/version.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/device.h>
+#include <linux/proc_fs.h>
+#include <linux/uprobes.h>
+#include <linux/uaccess.h>
+#include <linux/sched/mm.h>
+#include <linux/eventfd.h>
+#include <linux/hrtimer.h>
+#include <linux/rcupdate.h>
+#include <linux/math64.h>
+#include <linux/compat.h>
+
+/* mm */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,17,0)
+typedef int vm_fault_t;
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,20,0)
+#define gd_vmf_insert_pfn_prot vmf_insert_pfn_prot
+#else
+static inline
+vm_fault_t gd_vmf_insert_pfn_prot(struct vm_area_struct *vma, unsigned long addr,
+                                  unsigned long pfn, pgprot_t pgprot)
+{
+   int err = vm_insert_pfn_prot(vma, addr, pfn, pgprot);
+
+   if (err == -ENOMEM)
+      return VM_FAULT_OOM;
+   if (err < 0 && err != -EBUSY)
+      return VM_FAULT_SIGBUS;
+
+   return VM_FAULT_NOPAGE;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+static inline void vm_flags_set(struct vm_area_struct *vma, unsigned long flags)
+{
+   vma->vm_flags |= flags;
+}
+
+static inline void vm_flags_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+   vma->vm_flags &= ~flags;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,1,0)
+#define VMA_ITERATOR(name, mm, addr) struct mm_struct *name = (mm)
+#define for_each_vma(name, vma) for((vma) = (name)->mmap; (vma); (vma) = (vma)->vm_next)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,8,0)
+static inline void mmap_read_lock(struct mm_struct *mm)
+{
+   down_read(&mm->mmap_sem);
+}
+
+static inline void mmap_read_unlock(struct mm_struct *mm)
+{
+   up_read(&mm->mmap_sem);
+}
+
+static inline
+long copy_from_user_nofault(void *dst, const void __user *src, size_t size)
+{
+   unsigned long not_copied;
+
+   pagefault_disable();
+   not_copied = __copy_from_user_inatomic(dst, src, size);
+   pagefault_enable();
+
+   return not_copied ? -EFAULT : 0;
+}
+#endif
+
+/* ->map_pages returns vm_fault_t and runs under rcu_read_lock(), so it can't
+ * allocate page tables */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
+#define GD_MAP_PAGES_ATOMIC
+#endif
+
+/* ->split became ->may_split */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,11,0)
+#define GD_HAVE_MAY_SPLIT
+#endif
+
+/* procfs */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define GD_HAVE_PROC_OPS
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,17,0)
+#define pde_data(inode) PDE_DATA(inode)
+#endif
+
+/* char device */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+#define gd_class_create(name) class_create(name)
+#else
+#define gd_class_create(name) class_create(THIS_MODULE, name)
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+#define no_llseek NULL
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,5,0)
+#ifdef CONFIG_COMPAT
+static inline
+long compat_ptr_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+   if(!file->f_op->unlocked_ioctl)
+      return -ENOIOCTLCMD;
+
+   return file->f_op->unlocked_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#else
+#define compat_ptr_ioctl NULL
+#endif
+#endif
+
+/* hrtimers */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+#define gd_hrtimer_setup(timer, fn, clock, mode) hrtimer_setup(timer, fn, clock, mode)
+#else
+#define gd_hrtimer_setup(timer, fn, clock, mode) do { \
+   hrtimer_init(timer, clock, mode); \
+   (timer)->function = fn; \
+} while(0)
+#endif
+
+/* rcu */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,5,0)
+#define rcu_replace_pointer(rcu_ptr, ptr, c) ({ \
+   typeof(ptr) old_ = rcu_dereference_protected((rcu_ptr), (c)); \
+   rcu_assign_pointer((rcu_ptr), (ptr)); \
+   old_; \
+})
+#endif
+
+/* math */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,9,0)
+/* a * b / c, giving up low bits of a and c while a * b wouldn't fit */
+static inline u64 mul_u64_u64_div_u64(u64 a, u64 b, u64 c)
+{
+   while(a && b > div64_u64(U64_MAX, a))
+   {
+      a >>= 1;
+      c >>= 1;
+   }
+
+   return c ? div64_u64(a * b, c) : U64_MAX;
+}
+#endif
+
+/* eventfd */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+#define gd_eventfd_signal(ctx) eventfd_signal(ctx)
+#else
+#define gd_eventfd_signal(ctx) eventfd_signal(ctx, 1)
+#endif
+
+/* uprobes */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+#define GD_UPROBE_HANDLER_ARGS struct uprobe_consumer *self, struct pt_regs *regs, __u64 *data
+#else
+#define GD_UPROBE_HANDLER_ARGS struct uprobe_consumer *self, struct pt_regs *regs
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,10,0)
+#define GD_UPROBE_FILTER_ARGS struct uprobe_consumer *self, struct mm_struct *mm
+#else
+#define GD_UPROBE_FILTER_ARGS struct uprobe_consumer *self, enum uprobe_filter_ctx ctx, struct mm_struct *mm
+#endif
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+typedef struct uprobe *gd_uprobe_t;
+
+static inline
+int gd_uprobe_register(struct inode *inode, loff_t offset, struct uprobe_consumer *uc, gd_uprobe_t *handle)
+{
+   struct uprobe *uprobe = uprobe_register(inode, offset, 0, uc);
+
+   if (IS_ERR(uprobe))
+      return PTR_ERR(uprobe);
+
+   *handle = uprobe;
+   return 0;
+}
+
+static inline
+void gd_uprobe_unregister(struct inode *inode, loff_t offset, struct uprobe_consumer *uc, gd_uprobe_t handle)
+{
+   uprobe_unregister_nosync(handle, uc);
+   uprobe_unregister_sync();
+}
+#else
+typedef void *gd_uprobe_t;
+
+static inline
+int gd_uprobe_register(struct inode *inode, loff_t offset, struct uprobe_consumer *uc, gd_uprobe_t *handle)
+{
+   *handle = NULL;
+   return uprobe_register(inode, offset, uc);
+}
+
+static inline
+void gd_uprobe_unregister(struct inode *inode, loff_t offset, struct uprobe_consumer *uc, gd_uprobe_t handle)
+{
+   uprobe_unregister(inode, offset, uc);
+}
+#endif
+
+#endif /* GPIOMEM_DUMMY_COMPAT_H_GUARD */
@@ -0,0 +1,37 @@
+#include "gpiomem_dummy_debugfs.h"
+
+#include <linux/debugfs.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_record.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "debugfs: "
+
+/* nothing in here is needed to run clients, so failing to set it up is only
+ * worth a message */
+void gd_debugfs_init(struct gpiomem_dummy *gd)
+{
+   gd->debugfs = debugfs_create_dir("gpiomem_dummy", NULL);
+   if(IS_ERR_OR_NULL(gd->debugfs))
+   {
+      pr_err("failed to create debugfs dir, no tracing");
+      gd->debugfs = NULL;
+      return;
+   }
+
+   gd_record_debugfs(&gd->board.record, gd->debugfs);
+   gd_replay_debugfs(&gd->board.replay, gd->debugfs);
+   gd_vcd_debugfs(&gd->board.vcd, gd->debugfs);
+   gd_relay_debugfs(&gd->board.relay, gd->debugfs);
+   gd_stats_debugfs(&gd->board.stats, gd->debugfs);
+   gd_lat_debugfs(&gd->lat, gd->debugfs);
+   gd_prof_debugfs(&gd->prof, gd->debugfs);
+}
+
+void gd_debugfs_destroy(struct gpiomem_dummy *gd)
+{
+   // the channel's files are in there
+   gd_relay_destroy(&gd->board.relay);
+   debugfs_remove_recursive(gd->debugfs);
+   gd->debugfs = NULL;
+}
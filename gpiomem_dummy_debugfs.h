@@ -0,0 +1,11 @@
+#ifndef GPIOMEM_DUMMY_DEBUGFS_H_GUARD
+#define GPIOMEM_DUMMY_DEBUGFS_H_GUARD
+
+struct gpiomem_dummy;
+
+/* /sys/kernel/debug/gpiomem_dummy, where the tracing and debugging files
+ * live */
+void gd_debugfs_init(struct gpiomem_dummy *gd);
+void gd_debugfs_destroy(struct gpiomem_dummy *gd);
+
+#endif /* GPIOMEM_DUMMY_DEBUGFS_H_GUARD */
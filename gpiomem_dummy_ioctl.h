@@ -0,0 +1,272 @@
+#ifndef GPIOMEM_DUMMY_IOCTL_H_GUARD
+#define GPIOMEM_DUMMY_IOCTL_H_GUARD
+
+/* ioctls on /dev/gpiomem for test harnesses. shared with userspace, so only
+ * fixed size types, and pointers are passed as __u64 */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define GD_IOC_MAGIC 'g'
+
+/* mmap offset of the control page. it sits between the gpio window at 0 and
+ * the peripheral window at its bus address, so it can't clash with either */
+#define GD_CTRL_OFFSET 0x40000000UL
+
+/* the control page. the harness drives inputs with plain stores, seqcount
+ * style: bump seq to odd, write pins/levels, bump seq to even (with a write
+ * barrier between each). the emulator applies the pair on its next sample
+ * (a client GPLEV read, or a harness read() of the registers) whenever seq
+ * is even and has moved */
+struct gd_ctrl_page {
+   __u32 seq;
+   __u32 flags; // must be 0
+   __u64 pins; // pins the page drives, others are left alone
+   __u64 levels;
+};
+
+/* pin masks are 64 bit words, bit n is gpio n */
+
+/* one input change: after delay_ns (counted from the previous step), drive
+ * the pins in pins to the matching bits of levels */
+struct gd_inject_step {
+   __u64 pins;
+   __u64 levels;
+   __u64 delay_ns;
+};
+
+struct gd_inject {
+   __u64 steps; // struct gd_inject_step *
+   __u32 count;
+   __u32 flags; // must be 0
+};
+
+/* apply count steps in order. returns the number applied, which is less than
+ * count if a signal arrived while waiting on a delay */
+#define GD_IOC_INJECT _IOW(GD_IOC_MAGIC, 0x01, struct gd_inject)
+
+/* pins whose level changes make poll() report POLLPRI on this fd. changes
+ * between two GD_IOC_WATCH_READs are coalesced into one wakeup */
+#define GD_IOC_WATCH_SET _IOW(GD_IOC_MAGIC, 0x02, __u64)
+
+struct gd_watch_event {
+   __u64 changed; // watched pins that changed at least once
+   __u64 count; // pin transitions behind that
+   __u64 level; // GPLEV at the time of the read
+};
+
+/* fetch and clear what accumulated since the last read */
+#define GD_IOC_WATCH_READ _IOR(GD_IOC_MAGIC, 0x03, struct gd_watch_event)
+
+#define GD_EDGE_RISING  0x1
+#define GD_EDGE_FALLING 0x2
+#define GD_EDGE_BOTH    (GD_EDGE_RISING | GD_EDGE_FALLING)
+
+struct gd_eventfd {
+   __s32 fd; // an eventfd
+   __u32 edges; // GD_EDGE_*
+   __u64 mask; // pins
+};
+
+/* signal fd (add 1 to its counter) whenever one of the pins in mask has an
+ * edge of the given kind. the binding lives until GD_IOC_EVENTFD_DEL with the
+ * same fd, or until this file is closed */
+#define GD_IOC_EVENTFD_ADD _IOW(GD_IOC_MAGIC, 0x04, struct gd_eventfd)
+#define GD_IOC_EVENTFD_DEL _IOW(GD_IOC_MAGIC, 0x05, struct gd_eventfd)
+
+#define GD_WAVE_REPEAT 0x1 // loop the steps, step 0's delay runs from the last one
+
+#define GD_WAVE_MAX_STEPS 65536
+#define GD_WAVE_MIN_PERIOD_NS 1000 // shortest loop of a GD_WAVE_REPEAT wave
+
+/* a waveform, played into the inputs by a timer in the background. steps are
+ * the same as for GD_IOC_INJECT. transitions due within slack_ns of a timer
+ * tick are applied in that tick, in order, each latching its own edges. a
+ * repeating wave the timer can't keep up with skips whole loops */
+struct gd_wave {
+   __u64 steps; // struct gd_inject_step *
+   __u32 count;
+   __u32 flags; // GD_WAVE_*
+   __u64 slack_ns;
+};
+
+/* replaces whatever waveform was playing */
+#define GD_IOC_WAVE_START _IOW(GD_IOC_MAGIC, 0x06, struct gd_wave)
+#define GD_IOC_WAVE_STOP _IO(GD_IOC_MAGIC, 0x07)
+
+/* loopback wiring: while src is an output, the pins in dst read its level as
+ * their input. a pin wired from several driving outputs sees them or'ed */
+struct gd_wire {
+   __u32 src; // pin number
+   __u32 flags; // must be 0
+   __u64 dst; // pins, 0 unwires src
+};
+
+#define GD_IOC_WIRE_SET _IOW(GD_IOC_MAGIC, 0x08, struct gd_wire)
+#define GD_IOC_WIRE_CLEAR _IO(GD_IOC_MAGIC, 0x09) // unwire everything
+
+/* userspace backend: client accesses to the registers a backend attached to
+ * are posted to it through a ring instead of going to the register model.
+ * reads wait for the backend's answer, writes are posted.
+ *
+ * the ring is mapped at GD_RING_OFFSET (one page) by the attaching fd. heads
+ * and tails are free running, entry n lives at index n % GD_RING_SIZE. the
+ * kernel produces req and consumes rsp, the backend the other way round, and
+ * every read gets exactly one rsp with its seq, writes none.
+ *
+ * both sides spin first. the backend sets backend_sleeping and calls
+ * GD_IOC_BACKEND_WAIT when it wants to sleep, and calls GD_IOC_BACKEND_KICK
+ * after producing a rsp (or consuming a req) if kernel_sleeping is set */
+#define GD_RING_OFFSET 0x40010000UL
+#define GD_RING_SIZE 64
+
+#define GD_RING_WRITE 0x1
+
+struct gd_ring_req {
+   __u32 seq;
+   __u32 off; // register offset
+   __u32 val; // written value
+   __u32 flags; // GD_RING_*
+   __u32 pid; // accessing process
+   __u32 tid;
+};
+
+struct gd_ring_rsp {
+   __u32 seq; // the read's
+   __u32 val; // what it reads
+};
+
+struct gd_ring {
+   __u32 req_head;
+   __u32 req_tail;
+   __u32 rsp_head;
+   __u32 rsp_tail;
+   __u32 backend_sleeping;
+   __u32 kernel_sleeping;
+   __u32 pad[2];
+   struct gd_ring_req req[GD_RING_SIZE];
+   struct gd_ring_rsp rsp[GD_RING_SIZE];
+};
+
+struct gd_backend_attach {
+   __u64 regs; // registers to service, bit n = offset 4n
+   __u32 flags; // must be 0
+   __u32 pad;
+};
+
+#define GD_IOC_BACKEND_ATTACH _IOW(GD_IOC_MAGIC, 0x0a, struct gd_backend_attach)
+#define GD_IOC_BACKEND_DETACH _IO(GD_IOC_MAGIC, 0x0b) // closing the fd does too
+#define GD_IOC_BACKEND_WAIT _IO(GD_IOC_MAGIC, 0x0c)
+#define GD_IOC_BACKEND_KICK _IO(GD_IOC_MAGIC, 0x0d)
+
+/* put the board back to its power-on state: registers, inputs and latched
+ * events cleared, wiring removed, waveform stopped, traces and counters
+ * emptied. mappings, watches, eventfds, backends and models stay attached.
+ * no edges are reported for the levels reset drops. also
+ * /sys/class/gpiomem/gpiomem/reset */
+#define GD_IOC_RESET _IO(GD_IOC_MAGIC, 0x0e)
+
+#define GD_SNAPSHOT_VERSION 1
+#define GD_SNAPSHOT_REGS 45 // the register file, in words
+#define GD_SNAPSHOT_PINS 54
+
+/* the whole board: register model, wiring, the waveform being played and the
+ * board's clock. the waveform steps go to/from a separate array */
+struct gd_snapshot {
+   __u32 version; // GD_SNAPSHOT_VERSION
+   __u32 size; // sizeof(struct gd_snapshot)
+
+   __u64 time_ns; // board time (since load or reset) when taken
+
+   __u32 regs[GD_SNAPSHOT_REGS]; // plain registers, as read back
+   __u32 pad0;
+   __u64 out; // output latch
+   __u64 in; // driven inputs
+   __u64 level;
+   __u64 eds;
+   __u64 wire[GD_SNAPSHOT_PINS];
+
+   __u64 wave_steps; // struct gd_inject_step *
+   __u32 wave_count; // GD_IOC_SNAPSHOT: in the room at wave_steps, out the number of steps
+   __u32 wave_pos; // next step
+   __u32 wave_flags;
+   __u32 pad1;
+   __u64 wave_slack_ns;
+   __u64 wave_next_ns; // board time the next step is due
+};
+
+/* fill in a snapshot. -ENOSPC (with wave_count set) if the waveform doesn't
+ * fit in wave_steps */
+#define GD_IOC_SNAPSHOT _IOWR(GD_IOC_MAGIC, 0x0f, struct gd_snapshot)
+
+/* go back to a snapshot. board time continues from its time_ns, and the
+ * waveform resumes where it was. no edges are reported for the jump */
+#define GD_IOC_RESTORE _IOW(GD_IOC_MAGIC, 0x10, struct gd_snapshot)
+
+/* record stream (debugfs gpiomem_dummy/record, fed back through replay). a
+ * run of records, each a header byte followed by LEB128 varints:
+ *
+ *   GD_REC_SYNC   'G' 'D' 'R', version, board time. resets the delta state
+ *                 below, so a reader can start at any SYNC
+ *   GD_REC_READ,  time since the previous record, register (offset / 4),
+ *   GD_REC_WRITE  value xor the last value recorded for that register, and
+ *                 the thread id if GD_REC_TID is set (it changed)
+ *   GD_REC_DROP   records lost because the reader fell behind, always
+ *                 followed by a SYNC
+ *
+ * the delta state starts out all zero, at board time 0 */
+#define GD_REC_VERSION 1
+
+#define GD_REC_TYPE 0x7
+#define GD_REC_SYNC 0
+#define GD_REC_READ 1
+#define GD_REC_WRITE 2
+#define GD_REC_DROP 3
+#define GD_REC_TID 0x8
+
+#define GD_REC_SYNC_EVERY 4096 // records between SYNCs
+#define GD_REC_MAX 48 // longest record
+
+/* access trace (debugfs gpiomem_dummy/access<cpu>), a run of these per cpu.
+ * each relay sub-buffer starts with a GD_TRACE_SUBBUF record, which has
+ * pid = GD_TRACE_MAGIC, the cpu in tid and the records that cpu lost to a
+ * full buffer since the previous header in val. being fixed size, the
+ * records stay aligned however the sub-buffers get spliced together */
+#define GD_TRACE_MAGIC 0x31544447 // "GDT1"
+
+#define GD_TRACE_WRITE 0x1
+#define GD_TRACE_SUBBUF 0x8000
+
+struct gd_trace_rec {
+   __u64 time; // board time
+   __u32 val;
+   __u32 tid;
+   __u32 pid; // tgid
+   __u16 off; // register offset
+   __u16 flags; // GD_TRACE_*
+};
+
+/* bpf context for the gpiomem_dummy:gd_access and gd_pins tracepoints, the
+ * one argument of raw tracepoint programs. fields only ever get added at
+ * the end */
+#define GD_BPF_WRITE 0x1
+
+struct gd_bpf_access {
+   __u64 time; // board time
+   __u32 off; // register offset
+   __u32 val; // read back or written
+   __u32 flags; // GD_BPF_*
+   __u32 pid; // tgid of the client making the access
+   __u32 tid;
+   __u32 pad;
+};
+
+/* pins that changed level, in one board update */
+struct gd_bpf_pins {
+   __u64 time; // board time
+   __u64 level; // GPLEV after the change
+   __u64 rising;
+   __u64 falling;
+};
+
+#endif /* GPIOMEM_DUMMY_IOCTL_H_GUARD */
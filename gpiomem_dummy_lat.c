@@ -0,0 +1,226 @@
+#include "gpiomem_dummy_lat.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+
+#include "gpiomem_dummy.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "lat: "
+
+static const char *const gd_lat_names[GD_LAT_STAGES] = {
+   [GD_LAT_FAULT] = "fault",
+   [GD_LAT_TRAP_BEGIN] = "trap_begin",
+   [GD_LAT_INSERT] = "insert",
+   [GD_LAT_PROBE] = "register_probe",
+   [GD_LAT_DECODE] = "decode",
+   [GD_LAT_UPROBE_REG] = "uprobe_register",
+   [GD_LAT_ROUNDTRIP] = "roundtrip",
+   [GD_LAT_HANDLER] = "handler",
+   [GD_LAT_TRAP_END] = "trap_end",
+   [GD_LAT_REARM] = "rearm",
+};
+
+void gd_lat_init(struct gd_lat *lat)
+{
+   memset(lat, 0, sizeof(*lat));
+   mutex_init(&lat->lock);
+}
+
+void gd_lat_destroy(struct gd_lat *lat)
+{
+   free_percpu(lat->pcpu);
+   lat->pcpu = NULL;
+}
+
+static void gd_lat_zero(struct gd_lat *lat)
+{
+   int cpu;
+
+   for_each_possible_cpu(cpu)
+   {
+      memset(per_cpu_ptr(lat->pcpu, cpu), 0, sizeof(struct gd_lat_pcpu));
+   }
+}
+
+/* a stage that ends while this runs may land in either side of it */
+void gd_lat_reset(struct gd_lat *lat)
+{
+   mutex_lock(&lat->lock);
+
+   if(lat->pcpu)
+   {
+      gd_lat_zero(lat);
+   }
+
+   mutex_unlock(&lat->lock);
+}
+
+static int gd_lat_set_enabled(struct gd_lat *lat, bool enable)
+{
+   int ret = 0;
+
+   mutex_lock(&lat->lock);
+
+   if(enable && !lat->pcpu)
+   {
+      lat->pcpu = alloc_percpu(struct gd_lat_pcpu);
+      if(!lat->pcpu)
+      {
+         ret = -ENOMEM;
+      }
+   }
+
+   if(ret == 0)
+   {
+      // the hot path finds pcpu set up once it sees enabled
+      smp_store_release(&lat->enabled, enable);
+   }
+
+   mutex_unlock(&lat->lock);
+
+   return ret;
+}
+
+static int gd_lat_show(struct seq_file *m, void *v)
+{
+   struct gd_lat *lat = m->private;
+   struct gd_lat_pcpu *sum = NULL;
+   unsigned int s, b;
+   u64 count = 0;
+   int cpu;
+
+   sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+   if(!sum)
+   {
+      return -ENOMEM;
+   }
+
+   mutex_lock(&lat->lock);
+
+   if(!lat->pcpu)
+   {
+      seq_puts(m, "disabled\n");
+      goto out;
+   }
+
+   for_each_possible_cpu(cpu)
+   {
+      struct gd_lat_pcpu *pcpu = per_cpu_ptr(lat->pcpu, cpu);
+
+      for(s = 0; s < GD_LAT_STAGES; s++)
+      {
+         for(b = 0; b < GD_LAT_BUCKETS; b++)
+         {
+            sum->hist[s][b] += READ_ONCE(pcpu->hist[s][b]);
+         }
+
+         sum->sum[s] += READ_ONCE(pcpu->sum[s]);
+      }
+   }
+
+   // one block per stage that ran, a line per non-empty bucket with its
+   // upper bound in ns
+   for(s = 0; s < GD_LAT_STAGES; s++)
+   {
+      for(count = 0, b = 0; b < GD_LAT_BUCKETS; b++)
+      {
+         count += sum->hist[s][b];
+      }
+
+      if(!count)
+      {
+         continue;
+      }
+
+      seq_printf(m, "%s count %llu mean_ns %llu\n", gd_lat_names[s], count, div64_u64(sum->sum[s], count));
+
+      for(b = 0; b < GD_LAT_BUCKETS; b++)
+      {
+         if(!sum->hist[s][b])
+         {
+            continue;
+         }
+
+         if(b == GD_LAT_BUCKETS - 1)
+         {
+            seq_printf(m, "  >=%llu %llu\n", 1ULL << (b - 1), sum->hist[s][b]);
+         }
+         else
+         {
+            seq_printf(m, "  <%llu %llu\n", 1ULL << b, sum->hist[s][b]);
+         }
+      }
+   }
+
+out:
+   mutex_unlock(&lat->lock);
+   kfree(sum);
+   return 0;
+}
+
+static int gd_lat_open(struct inode *inode, struct file *filep)
+{
+   return single_open(filep, gd_lat_show, inode->i_private);
+}
+
+/* any write clears the histograms, and nothing else gd_reset would */
+static ssize_t gd_lat_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct seq_file *m = filep->private_data;
+
+   gd_lat_reset(m->private);
+
+   return count;
+}
+
+static const struct file_operations gd_lat_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_lat_open,
+   .read = seq_read,
+   .write = gd_lat_write,
+   .llseek = seq_lseek,
+   .release = single_release,
+};
+
+static ssize_t gd_lat_enable_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_lat *lat = filep->private_data;
+   char buf[3] = { gd_lat_enabled(lat) ? '1' : '0', '\n', 0 };
+
+   return simple_read_from_buffer(ubuf, count, ppos, buf, 2);
+}
+
+static ssize_t gd_lat_enable_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_lat *lat = filep->private_data;
+   bool enable = false;
+   int ret = 0;
+
+   ret = kstrtobool_from_user(ubuf, count, &enable);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   ret = gd_lat_set_enabled(lat, enable);
+
+   return ret ? ret : count;
+}
+
+static const struct file_operations gd_lat_enable_fops = {
+   .owner = THIS_MODULE,
+   .open = simple_open,
+   .read = gd_lat_enable_read,
+   .write = gd_lat_enable_write,
+};
+
+void gd_lat_debugfs(struct gd_lat *lat, struct dentry *dir)
+{
+   debugfs_create_file("latency_enable", 0600, dir, lat, &gd_lat_enable_fops);
+   debugfs_create_file("latency", 0600, dir, lat, &gd_lat_fops);
+}
@@ -0,0 +1,80 @@
+#ifndef GPIOMEM_DUMMY_LAT_H_GUARD
+#define GPIOMEM_DUMMY_LAT_H_GUARD
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/dcache.h>
+
+/* the stages of a trapped access that get timed */
+enum gd_lat_stage {
+   GD_LAT_FAULT, // the whole gpio fault, entry to return
+   GD_LAT_TRAP_BEGIN, // gd_board_trap_begin() in the fault
+   GD_LAT_INSERT, // mapping the page in
+   GD_LAT_PROBE, // gd_register_probe(), decode and lookup included
+   GD_LAT_DECODE, // get_next_ip()
+   GD_LAT_UPROBE_REG, // uprobe_register() for a new site, in the work item
+   GD_LAT_ROUNDTRIP, // end of the fault to the uprobe handler running
+   GD_LAT_HANDLER, // the whole uprobe handler
+   GD_LAT_TRAP_END, // gd_board_trap_end() in the handler
+   GD_LAT_REARM, // unmapping the page again
+   GD_LAT_STAGES
+};
+
+// bucket b counts [2^(b-1), 2^b) ns, the last one everything longer
+#define GD_LAT_BUCKETS 40
+
+struct gd_lat_pcpu
+{
+   u64 hist[GD_LAT_STAGES][GD_LAT_BUCKETS];
+   u64 sum[GD_LAT_STAGES]; // ns, for the mean
+};
+
+/* per cpu log2 histograms of how long each stage takes. switched with
+ * debugfs latency_enable, read from latency, cleared by writing to it */
+struct gd_lat
+{
+   bool enabled;
+   struct mutex lock; // enable/reset/fold
+   struct gd_lat_pcpu __percpu *pcpu; // from the first enable on
+};
+
+static inline
+bool gd_lat_enabled(struct gd_lat *lat)
+{
+   return smp_load_acquire(&lat->enabled);
+}
+
+/* a stage's start time, 0 if nobody is timing */
+static inline
+u64 gd_lat_start(struct gd_lat *lat)
+{
+   return gd_lat_enabled(lat) ? ktime_get_ns() : 0;
+}
+
+static inline
+void gd_lat_end(struct gd_lat *lat, enum gd_lat_stage stage, u64 start)
+{
+   u64 ns = 0;
+
+   // started while disabled. pcpu outlives disabling, so the other way is fine
+   if(!start)
+   {
+      return;
+   }
+
+   ns = ktime_get_ns() - start;
+
+   this_cpu_inc(lat->pcpu->hist[stage][min_t(unsigned int, fls64(ns), GD_LAT_BUCKETS - 1)]);
+   this_cpu_add(lat->pcpu->sum[stage], ns);
+}
+
+void gd_lat_init(struct gd_lat *lat);
+void gd_lat_destroy(struct gd_lat *lat);
+void gd_lat_reset(struct gd_lat *lat);
+void gd_lat_debugfs(struct gd_lat *lat, struct dentry *dir);
+
+#endif /* GPIOMEM_DUMMY_LAT_H_GUARD */
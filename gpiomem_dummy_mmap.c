@@ -7,10 +7,16 @@
 #include <linux/hw_breakpoint.h>
 
 #include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
 #include "gpiomem_dummy_probe.h"
+#include "gpiomem_dummy_pmu.h"
 
 #define LOG_PREFIX LOG_PREFIX_ "mmap: "
 
+static bool populate = false;
+module_param(populate, bool, 0644);
+MODULE_PARM_DESC(populate, "map every non-trapping peripheral page at mmap time (MAP_POPULATE for the whole window, allocates a page for each)");
+
 /* memory handler functions */
 
 
@@ -26,9 +32,23 @@ static void mmap_open(struct vm_area_struct* vma)
       return;
    }
 
+   if (mm != current->mm)
+   {
+      /* dup_mmap() for a forked child. the flags came along with the vma
+       * and the child registers its probes lazily on its first fault, so
+       * there's nothing to do for it here */
+      pr_debug("vma inherited by fork");
+      return;
+   }
+
    //vma->vm_flags = (vma->vm_flags | VM_DONTEXPAND | VM_DONTCOPY | VM_DONTDUMP | VM_IO | VM_MAYREAD | VM_MIXEDMAP);
-   vma->vm_flags |= VM_DONTCOPY | VM_DONTDUMP | VM_DONTEXPAND | VM_SHARED |
-      VM_LOCKED | VM_WRITE | VM_PFNMAP;
+   /* no VM_DONTCOPY: forked children keep the mapping and share the board.
+    * a child usually starts out with the gpio page unmapped and faults just
+    * like the parent. if another thread forks while one sits between its
+    * fault and the uprobe, the child gets the page mapped, and its first hit
+    * on that uprobe unmaps it again (gd_mmap_rearm_all()) */
+   vm_flags_set(vma, VM_DONTDUMP | VM_DONTEXPAND | VM_SHARED |
+      VM_LOCKED | VM_WRITE | VM_PFNMAP);
    //vma->vm_flags &= ~(VM_MAYWRITE /*| VM_WRITE*/);
    vma->vm_page_prot = pgprot_noncached(vm_get_page_prot(vma->vm_flags));
 
@@ -38,8 +58,16 @@ static void mmap_open(struct vm_area_struct* vma)
 
 static void mmap_close(struct vm_area_struct* vma)
 {
-   // do nothing
+   struct gpiomem_dummy *gd = gd_get_from_vma(vma);
+
    printk(KERN_DEBUG LOG_PREFIX "mmap_close\n");
+
+   /* the mm may be about to go away and its address reused, so forget its
+    * probes now. any other mapping in the same mm just re-registers them */
+   if(gd)
+   {
+      gd_remove_mm_probes(gd, vma->vm_mm);
+   }
 }
 
 static inline
@@ -63,71 +91,201 @@ struct page *vmf_get_page(struct vm_fault *vmf)
    return gd ? gd->page : NULL;
 }
 
-void hw_breakpoint_trigger(struct perf_event *event, struct perf_sample_data *data, struct pt_regs *regs)
+static inline
+unsigned long vma_pgoff_to_addr(struct vm_area_struct *vma, pgoff_t pgoff)
 {
-   pr_info("hw hw_breakpoint!");
-   //unregister_hw_breakpoint(event);
+   return vma->vm_start + ((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
 }
 
-static int mmap_fault(struct vm_fault* vmf)
+/* the page behind peripheral pgoff, allocated the first time anyone touches
+ * it. each has its own, so a write to one peripheral doesn't show up in the
+ * registers of every other. NULL when out of memory */
+static struct page *gd_periph_page(struct gpiomem_dummy *gd, pgoff_t pgoff, gfp_t gfp)
 {
-   struct page *page = NULL;
-   struct vm_area_struct *vma = vmf->vma;
-   struct perf_event_attr pe_attr;
-   int insret = -ENODEV;
+   struct page *page = xa_load(&gd->periph_pages, pgoff);
+   struct page *old = NULL;
+
+   if(page)
+   {
+      return page;
+   }
+
+   page = alloc_page(gfp | __GFP_ZERO);
+   if(!page)
+   {
+      return NULL;
+   }
+
+   // someone else faulting on it at the same time wins
+   old = xa_cmpxchg(&gd->periph_pages, pgoff, NULL, page, gfp);
+   if(old)
+   {
+      __free_page(page);
+      return xa_is_err(old) ? NULL : old;
+   }
+
+   return page;
+}
+
+/* map the plain peripheral page for pgoff at addr. it never traps, so once
+ * it's in it stays in. a pte that's already there (map_pages got to it
+ * first) is fine */
+static vm_fault_t gd_insert_periph(struct vm_area_struct *vma, unsigned long addr, pgoff_t pgoff, gfp_t gfp)
+{
+   struct page *page = gd_periph_page(gd_get_from_vma(vma), pgoff, gfp);
 
-   printk(KERN_DEBUG LOG_PREFIX "fault: pgoff=0x%lx addr=0x%lx pte=%p\n", vmf->pgoff, vmf->address - vma->vm_start, vmf->pte);
+   if(!page)
+   {
+      return VM_FAULT_OOM;
+   }
 
-   printk("fault: flags ");
-   if(vmf->flags & FAULT_FLAG_INSTRUCTION)
-      printk(KERN_CONT "INST ");
-   if(vmf->flags & FAULT_FLAG_KILLABLE)
-      printk(KERN_CONT "KILLABLE ");
-   if(vmf->flags & FAULT_FLAG_MKWRITE)
-      printk(KERN_CONT "MKWRITE ");
-   if(vmf->flags & FAULT_FLAG_REMOTE)
-      printk(KERN_CONT "REMOTE ");
-   if(vmf->flags & FAULT_FLAG_TRIED)
-      printk(KERN_CONT "TRIED ");
-   if(vmf->flags & FAULT_FLAG_USER)
-      printk(KERN_CONT "USER ");
-   if(vmf->flags & FAULT_FLAG_WRITE)
-      printk(KERN_CONT "WRITE ");
+   return gd_vmf_insert_pfn_prot(vma, addr, page_to_pfn(page), vma->vm_page_prot);
+}
 
-   printk("");
+/* map every non-trapping page in [start_pgoff, end_pgoff], skipping skip_addr */
+static vm_fault_t gd_insert_periph_range(struct vm_area_struct *vma, pgoff_t start_pgoff,
+                                         pgoff_t end_pgoff, unsigned long skip_addr, gfp_t gfp)
+{
+   pgoff_t pgoff;
+   vm_fault_t insret = 0;
 
-   if(vmf->pte)
+   for(pgoff = start_pgoff; pgoff <= end_pgoff; pgoff++)
    {
-      pr_info("we have a pte!");
+      unsigned long addr = vma_pgoff_to_addr(vma, pgoff);
+
+      if(gd_pgoff_is_gpio(pgoff) || addr == skip_addr)
+      {
+         continue;
+      }
+
+      insret = gd_insert_periph(vma, addr, pgoff, gfp);
+      if(insret & VM_FAULT_ERROR)
+      {
+         pr_err("failed to insert peripheral page at pgoff=0x%lx: 0x%x", pgoff, insret);
+         return insret;
+      }
    }
-   else
+
+   return 0;
+}
+
+int gd_mmap_populate(struct vm_area_struct *vma)
+{
+   pgoff_t npages = vma_pages(vma);
+
+   if(!populate || !npages)
    {
-      pr_info("we do not have a pte!");
+      return 0;
    }
 
-   page = vmf_get_page(vmf);
+   return gd_insert_periph_range(vma, vma->vm_pgoff, vma->vm_pgoff + npages - 1, 0, GFP_USER) ? -ENOMEM : 0;
+}
 
-   if(!page || IS_ERR(page))
+/* the harness' control page is plain shared memory, map it up front and
+ * never trap on it */
+int gd_mmap_ctrl(struct vm_area_struct *vma)
+{
+   struct gpiomem_dummy *gd = gd_get_from_vma(vma);
+
+   if(vma->vm_end - vma->vm_start != PAGE_SIZE)
    {
-      pr_err("unable to get mem pointer");
-      return VM_FAULT_SIGBUS;
+      pr_err("control page mapping must be one page");
+      return -EINVAL;
    }
 
-   if(vma->vm_flags & VM_WRITE)
+   return remap_pfn_range(vma, vma->vm_start, page_to_pfn(gd->ctrl_page), PAGE_SIZE, vma->vm_page_prot);
+}
+
+/* unmap the gpio page at addr again, so the next access faults */
+void gd_mmap_rearm(struct mm_struct *mm, unsigned long addr)
+{
+   struct vm_area_struct *vma = NULL;
+
+   mmap_read_lock(mm);
+
+   vma = find_vma(mm, addr);
+   if(vma && vma->vm_start <= addr && vma->vm_ops == &gpiomem_dummy_mmap_vmops)
    {
-      pr_info("vma is writeable");
+      zap_vma_ptes(vma, addr, PAGE_SIZE);
    }
-   else {
-      pr_info("vma is not writable");
+
+   mmap_read_unlock(mm);
+}
+
+/* unmap the gpio page from every mapping of ours in mm. for when we don't
+ * know which address the access that left it mapped went to */
+void gd_mmap_rearm_all(struct mm_struct *mm)
+{
+   struct vm_area_struct *vma = NULL;
+   const pgoff_t gpio_pgoffs[] = { 0, BCM283X_PERIPH_PGOFF + BCM283X_GPIO_PGOFF };
+   unsigned int i;
+   VMA_ITERATOR(vmi, mm, 0);
+
+   mmap_read_lock(mm);
+
+   for_each_vma(vmi, vma)
+   {
+      if(vma->vm_ops != &gpiomem_dummy_mmap_vmops)
+      {
+         continue;
+      }
+
+      for(i = 0; i < ARRAY_SIZE(gpio_pgoffs); i++)
+      {
+         unsigned long addr = 0;
+
+         if(gpio_pgoffs[i] < vma->vm_pgoff || gpio_pgoffs[i] >= vma->vm_pgoff + vma_pages(vma))
+         {
+            continue;
+         }
+
+         addr = vma_pgoff_to_addr(vma, gpio_pgoffs[i]);
+         zap_vma_ptes(vma, addr, PAGE_SIZE);
+      }
    }
 
-   if(vmf->flags & FAULT_FLAG_WRITE)
+   mmap_read_unlock(mm);
+}
+
+void hw_breakpoint_trigger(struct perf_event *event, struct perf_sample_data *data, struct pt_regs *regs)
+{
+   pr_info("hw hw_breakpoint!");
+   //unregister_hw_breakpoint(event);
+}
+
+static vm_fault_t mmap_fault(struct vm_fault* vmf)
+{
+   struct page *page = NULL;
+   struct vm_area_struct *vma = vmf->vma;
+   struct perf_event_attr pe_attr;
+   struct gd_lat *lat = &vmf_get_gd(vmf)->lat;
+   vm_fault_t insret = VM_FAULT_SIGBUS;
+   u64 fault_start = 0, prof_start = 0, start = 0;
+
+   if(!gd_pgoff_is_gpio(vmf->pgoff))
    {
-      pr_info("write to page");
+      insret = gd_insert_periph(vma, vmf->address, vmf->pgoff, GFP_USER);
+      if(insret & VM_FAULT_ERROR)
+      {
+         pr_err("failed to insert peripheral page: 0x%x", insret);
+      }
+
+      return insret;
    }
-   else
+
+   fault_start = gd_lat_start(lat);
+   prof_start = gd_prof_start(&vmf_get_gd(vmf)->prof);
+
+   // anything louder than pr_debug here ends up dominating the latencies
+   pr_debug("fault: pgoff=0x%lx addr=0x%lx flags=0x%x pte=%p", vmf->pgoff, vmf->address - vma->vm_start,
+            (unsigned int)vmf->flags, vmf->pte);
+
+   page = vmf_get_page(vmf);
+
+   if(!page || IS_ERR(page))
    {
-      pr_info("read from page");
+      pr_err("unable to get mem pointer");
+      return VM_FAULT_SIGBUS;
    }
 
    // set page rw for now
@@ -138,92 +296,99 @@ static int mmap_fault(struct vm_fault* vmf)
    //pe_attr.bp_addr =
    //register_user_hw_breakpoint(&pe_attr, hw_breakpoint_trigger, NULL /* user data */, current);
 
-   insret = vm_insert_pfn(vma, vmf->address, page_to_pfn(page));
+   // let the client see the current register state, the write (if any) is picked up by the probe
+   start = gd_lat_start(lat);
+   gd_board_trap_begin(&vmf_get_gd(vmf)->board, vmf->address & ~PAGE_MASK, vmf->flags & FAULT_FLAG_WRITE);
+   gd_lat_end(lat, GD_LAT_TRAP_BEGIN, start);
+
+   gd_pmu_access(vmf->flags & FAULT_FLAG_WRITE);
+
+   start = gd_lat_start(lat);
+   insret = gd_vmf_insert_pfn_prot(vma, vmf->address, page_to_pfn(page), vma->vm_page_prot);
+   gd_lat_end(lat, GD_LAT_INSERT, start);
 
    //insret = vm_insert_page(vma, vmf->address, page);
-   if (insret != 0)
+   if (insret & VM_FAULT_ERROR)
    {
-      pr_err("failed to insert page: %d", insret);
-      return VM_FAULT_ERROR;
+      pr_err("failed to insert page: 0x%x", insret);
+      return insret;
    }
 
-   // register probe on /next/ instruction, then we'll mark page ro again after
-   if(gd_register_probe(current, vma) != 0)
+   /* register probe on /next/ instruction, then we'll unmap the page again
+    * after. only the vma is locked here: new uprobes get installed from a
+    * work item, so a 16 thread client faulting on 16 cpus never queues up
+    * behind mmap_sem */
+   start = gd_lat_start(lat);
+   if(gd_register_probe(current, vma, vmf->address, !!(vmf->flags & FAULT_FLAG_WRITE), prof_start) != 0)
    {
       pr_err("failed to register gd probe");
-      return VM_FAULT_ERROR;
+      return VM_FAULT_SIGBUS;
    }
+   gd_lat_end(lat, GD_LAT_PROBE, start);
+
 
    //vmf->page = page;
    //get_page(page);
    //lock_page(page);
 
-   pr_info("mmap_fault done");
+   gd_lat_end(lat, GD_LAT_FAULT, fault_start);
    return VM_FAULT_NOPAGE;
 }
 
-int split(struct vm_area_struct * area, unsigned long addr)
+static int split(struct vm_area_struct * area, unsigned long addr)
 {
    printk(KERN_DEBUG LOG_PREFIX "split!\n");
    return 0;
 }
 
-int mremap(struct vm_area_struct * area)
+static int mremap(struct vm_area_struct * area)
 {
    printk(KERN_DEBUG LOG_PREFIX "mremap!\n");
    return 0;
 }
 
-void map_pages(struct vm_fault *vmf,
-                  pgoff_t start_pgoff, pgoff_t end_pgoff)
+/* fault-around for read faults. everything but the gpio page is plain memory,
+ * so map the lot in one go and let the library's init sequence take one fault
+ * instead of one per page. the faulting page itself is left to mmap_fault() */
+static void gd_map_pages(struct vm_fault *vmf,
+                         pgoff_t start_pgoff, pgoff_t end_pgoff)
 {
-   /*pgd_t *pgd;
-   p4d_t *p4d;
-   pud_t *pud;
-   pmd_t *pmd;
-   pte_t *pte;
-   unsigned long addr;
-*/
    printk(KERN_DEBUG LOG_PREFIX "map_pages! start=%lu end=%lu\n", start_pgoff, end_pgoff);
 
-  /* addr = vmf->address;
+#ifdef GD_MAP_PAGES_ATOMIC
+   /* no sleeping here, and inserting into an empty pmd would allocate. the
+    * first fault in the pmd goes through mmap_fault(), the rest get batched */
+   if(pmd_none(*vmf->pmd))
+   {
+      return;
+   }
+#endif
 
-   pgd = pgd_offset(vmf->vma->vm_mm, addr);
-   p4d = p4d_offset(pgd, addr);
-   pud = pud_offset(p4d, addr);
-   pmd = pmd_offset(pud, addr);
-   pte_alloc_map()
-   vmf->pte = pte_offset_map(pmd, addr);*/
+   // under rcu here, pages nobody touched yet are only allocated if that's cheap
+   gd_insert_periph_range(vmf->vma, start_pgoff, end_pgoff, vmf->address & PAGE_MASK, GFP_NOWAIT | __GFP_NOWARN);
 }
 
-/* notification that a previously read-only page is about to become
- * writable, if an error is returned it will cause a SIGBUS */
-int mmap_mkwrite(struct vm_fault *vmf)
+#ifdef GD_MAP_PAGES_ATOMIC
+static vm_fault_t map_pages(struct vm_fault *vmf,
+                            pgoff_t start_pgoff, pgoff_t end_pgoff)
 {
-   struct vm_area_struct *vma = vmf->vma;
-
-   printk(KERN_DEBUG LOG_PREFIX "page_mkwrite!\n");
-   //vma->vm_flags |= VM_WRITE;
-   //vma->vm_page_prot = pgprot_noncached(vm_get_page_prot(vma->vm_flags));
-
-   lock_page(vmf->page);
-   //set_page_dirty(vmf->page);
+   gd_map_pages(vmf, start_pgoff, end_pgoff);
 
-   return VM_FAULT_LOCKED;
+   // let mmap_fault() handle the faulting address itself
+   return 0;
 }
-
-int pfn_mkwrite(struct vm_fault *vmf)
+#else
+static void map_pages(struct vm_fault *vmf,
+                      pgoff_t start_pgoff, pgoff_t end_pgoff)
 {
-   printk(KERN_DEBUG LOG_PREFIX "pfn_mkwrite!\n");
-   lock_page(vmf->page);
-   set_page_dirty(vmf->page);
-   return VM_FAULT_LOCKED;
+   gd_map_pages(vmf, start_pgoff, end_pgoff);
 }
+#endif
 
 /* called by access_process_vm when get_user_pages() fails, typically
  * for use by special VMAs that can switch between memory and hardware
  */
-int mmap_access(struct vm_area_struct *vma, unsigned long addr,
+static int mmap_access(struct vm_area_struct *vma, unsigned long addr,
               void *buf, int len, int write)
 {
    printk(KERN_DEBUG LOG_PREFIX "access: addr=0x%lx len=%d write=%d\n", addr, len, write);
@@ -232,14 +397,16 @@ int mmap_access(struct vm_area_struct *vma, unsigned long addr,
 
 
 
-struct vm_operations_struct gpiomem_dummy_mmap_vmops = {
+const struct vm_operations_struct gpiomem_dummy_mmap_vmops = {
    .open  = mmap_open,  /* mmap-open */
    .close = mmap_close, /* mmap-close */
    .fault = mmap_fault, /* fault handler */
-   .page_mkwrite = mmap_mkwrite,
-   .pfn_mkwrite = pfn_mkwrite,
    .access = mmap_access,
+#ifdef GD_HAVE_MAY_SPLIT
+   .may_split = split,
+#else
    .split = split,
+#endif
    .mremap = mremap,
    .map_pages = map_pages
 };
@@ -4,6 +4,11 @@
 #include <linux/mm_types.h>
 #include <linux/mm.h>
 
-extern struct vm_operations_struct gpiomem_dummy_mmap_vmops;
+extern const struct vm_operations_struct gpiomem_dummy_mmap_vmops;
+
+int gd_mmap_populate(struct vm_area_struct *vma);
+void gd_mmap_rearm(struct mm_struct *mm, unsigned long addr);
+void gd_mmap_rearm_all(struct mm_struct *mm);
+int gd_mmap_ctrl(struct vm_area_struct *vma);
 
 #endif /* GPIOMEM_DUMMY_MMAP_H_GUARD */
@@ -32,6 +32,7 @@
 #include "gpiomem_dummy_procfs.h"
 #include "gpiomem_dummy_cdev.h"
 #include "gpiomem_dummy_pdev.h"
+#include "gpiomem_dummy_pmu.h"
 
 MODULE_LICENSE("GPL");            ///< The license type -- this affects available functionality
 MODULE_AUTHOR("Thomas Fjellstrom");    ///< The author -- visible when you use modinfo
@@ -47,6 +48,37 @@ struct gpiomem_dummy *gd_get()
    return dummy;
 }
 
+/* per-test reset, everything a test could have left behind goes back to how
+ * the module came up, without touching anyone's mappings */
+void gd_reset(struct gpiomem_dummy *gd)
+{
+   gd_board_reset(&gd->board);
+   gd_record_reset(&gd->board.record);
+   gd_replay_reset(&gd->board.replay);
+   gd_vcd_reset(&gd->board.vcd);
+   gd_relay_reset(&gd->board.relay);
+   gd_stats_reset(&gd->board.stats);
+   gd_lat_reset(&gd->lat);
+   gd_prof_reset(&gd->prof);
+
+   pr_info("board reset");
+}
+
+
+/* the pages behind the peripherals we don't emulate. nothing maps them
+ * anymore by the time this runs */
+static void gd_free_periph(struct gpiomem_dummy *gd)
+{
+   struct page *page = NULL;
+   unsigned long pgoff;
+
+   xa_for_each(&gd->periph_pages, pgoff, page)
+   {
+      __free_page(page);
+   }
+
+   xa_destroy(&gd->periph_pages);
+}
 
 /** @brief The LKM initialization function
  *  The static keyword restricts the visibility of the function to within this C file. The __init
@@ -73,6 +105,9 @@ static int __init gpiomem_init(void)
       return -ENOMEM;
    }
 
+   // peripheral pages are allocated on first touch, one per pgoff
+   xa_init(&new_dummy->periph_pages);
+
    /*
    error_ret = gd_pdrv_init(&new_dummy->pdev);
    if(error_ret != 0)
@@ -97,6 +132,16 @@ static int __init gpiomem_init(void)
    pdata = (unsigned long*)page_to_virt(new_dummy->page);
    memset(pdata, 0, PAGE_SIZE);
 
+   new_dummy->ctrl_page = alloc_page(GFP_USER | __GFP_ZERO);
+   if(!new_dummy->ctrl_page)
+   {
+      pr_err("failed to allocate control page");
+      error_ret = -ENOMEM;
+      goto err_cleanup;
+   }
+
+   gd_board_init(&new_dummy->board, new_dummy->page, new_dummy->ctrl_page);
+
    //pr_info("set_page_ro");
    //error_ret = gd_set_page_ro(new_dummy->page);
    //check_val_cleanup(error_ret, "failed to set page ro");
@@ -111,6 +156,17 @@ static int __init gpiomem_init(void)
    //new_dummy->page->mapping->a_ops = &cdev_aops;
 
    INIT_LIST_HEAD_RCU(&new_dummy->probe_list);
+   hash_init(new_dummy->probe_hash);
+   hash_init(new_dummy->site_hash);
+   spin_lock_init(&new_dummy->probe_lock);
+   INIT_LIST_HEAD(&new_dummy->pending_sites);
+   INIT_LIST_HEAD(&new_dummy->dead_sites);
+   INIT_WORK(&new_dummy->site_work, gd_site_work);
+   gd_lat_init(&new_dummy->lat);
+   gd_prof_init(&new_dummy->prof);
+
+   gd_debugfs_init(new_dummy);
+   gd_pmu_init();
 
    new_dummy->initialized = 1;
 
@@ -128,6 +184,14 @@ err_cleanup:
       new_dummy->page = NULL;
    }
 
+   gd_free_periph(new_dummy);
+
+   if(new_dummy->ctrl_page)
+   {
+      __free_pages(new_dummy->ctrl_page, 0);
+      new_dummy->ctrl_page = NULL;
+   }
+
    gpiomem_dummy_procfs_destroy(&new_dummy->proc);
 
    //gpiomem_dummy_pdrv_exit(&new_dummy->pdev);
@@ -153,6 +217,13 @@ static void __exit gpiomem_exit(void)
 
    gpiomem_dummy_procfs_destroy(&dummy->proc);
    gd_cdev_destroy(&dummy->cdev);
+   gd_debugfs_destroy(dummy);
+   gd_pmu_destroy();
+
+   gd_remove_probes(dummy);
+   gd_board_destroy(&dummy->board);
+   gd_lat_destroy(&dummy->lat);
+   gd_prof_destroy(&dummy->prof);
 
    if(dummy->page)
    {
@@ -160,6 +231,14 @@ static void __exit gpiomem_exit(void)
       dummy->page = NULL;
    }
 
+   gd_free_periph(dummy);
+
+   if(dummy->ctrl_page)
+   {
+      __free_pages(dummy->ctrl_page, 0);
+      dummy->ctrl_page = NULL;
+   }
+
    dummy->initialized = 0;
 
    dummy = NULL;
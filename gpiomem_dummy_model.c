@@ -0,0 +1,155 @@
+#include "gpiomem_dummy_model.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/lockdep.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "model: "
+
+static enum hrtimer_restart gd_model_tick(struct hrtimer *timer)
+{
+   struct gd_model *model = container_of(timer, struct gd_model, timer);
+   struct gd_board *board = READ_ONCE(model->board);
+   unsigned long flags;
+
+   if(!board)
+   {
+      return HRTIMER_NORESTART;
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   // unregister detaches under the lock before cancelling us
+   if(model->board && model->ops->timer)
+   {
+      model->ops->timer(model);
+
+      if(board->model_dirty)
+      {
+         gd_board_update_locked(board);
+         gd_board_sync_page_locked(board);
+      }
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   return HRTIMER_NORESTART;
+}
+
+/* attach model to the board. its pins are reported from the next change on */
+int gd_model_register(struct gd_model *model)
+{
+   struct gpiomem_dummy *gd = gd_get();
+   struct gd_board *board = NULL;
+   unsigned long flags;
+   int ret = 0;
+
+   if(!gd || !model->ops)
+   {
+      return -ENODEV;
+   }
+
+   board = &gd->board;
+
+   model->pins &= GD_ALL_PINS;
+   model->drives &= GD_ALL_PINS;
+   gd_hrtimer_setup(&model->timer, gd_model_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(board->model_drives & model->drives)
+   {
+      ret = -EBUSY;
+   }
+   else
+   {
+      model->board = board;
+      list_add_tail(&model->list, &board->models);
+      board->model_mask |= model->pins;
+      board->model_drives |= model->drives;
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   if(ret == 0)
+   {
+      pr_info("attached model %s: pins=0x%llx drives=0x%llx", model->name ?: "?", model->pins, model->drives);
+   }
+
+   return ret;
+}
+EXPORT_SYMBOL_GPL(gd_model_register);
+
+/* detach model. no callbacks run once this returns, the inputs it drove keep
+ * their last levels */
+void gd_model_unregister(struct gd_model *model)
+{
+   struct gd_board *board = model->board;
+   struct gd_model *other = NULL;
+   unsigned long flags;
+
+   if(!board)
+   {
+      return;
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+
+   list_del(&model->list);
+   WRITE_ONCE(model->board, NULL);
+
+   board->model_mask = 0;
+   board->model_drives = 0;
+   list_for_each_entry(other, &board->models, list)
+   {
+      board->model_mask |= other->pins;
+      board->model_drives |= other->drives;
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   hrtimer_cancel(&model->timer);
+
+   pr_info("detached model %s", model->name ?: "?");
+}
+EXPORT_SYMBOL_GPL(gd_model_unregister);
+
+/* drive the model's inputs in pins to levels. the board settles once the
+ * callback returns, so changes it causes are reported in the same step */
+void gd_model_drive(struct gd_model *model, u64 pins, u64 levels)
+{
+   struct gd_board *board = model->board;
+
+   lockdep_assert_held(&board->lock);
+
+   gd_board_set_inputs_locked(board, pins & model->drives, levels);
+   board->model_dirty = true;
+}
+EXPORT_SYMBOL_GPL(gd_model_drive);
+
+u64 gd_model_level(struct gd_model *model)
+{
+   lockdep_assert_held(&model->board->lock);
+
+   return model->board->level;
+}
+EXPORT_SYMBOL_GPL(gd_model_level);
+
+/* call ops->timer once, delay_ns from now. re-arming replaces the old expiry */
+void gd_model_timer_start(struct gd_model *model, u64 delay_ns)
+{
+   hrtimer_start(&model->timer, ns_to_ktime(delay_ns), HRTIMER_MODE_REL_SOFT);
+}
+EXPORT_SYMBOL_GPL(gd_model_timer_start);
+
+/* callers hold the board lock the timer callback takes, so this can't wait
+ * for a running callback, it only stops a pending expiry */
+void gd_model_timer_cancel(struct gd_model *model)
+{
+   hrtimer_try_to_cancel(&model->timer);
+}
+EXPORT_SYMBOL_GPL(gd_model_timer_cancel);
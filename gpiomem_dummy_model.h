@@ -0,0 +1,62 @@
+#ifndef GPIOMEM_DUMMY_MODEL_H_GUARD
+#define GPIOMEM_DUMMY_MODEL_H_GUARD
+
+/* device models: other modules simulating parts hanging off the pins
+ * (buttons, sensors, shift registers, ...). a model attaches to the board,
+ * gets called when its pins change, and drives inputs back in the same
+ * emulation step, without a round trip through userspace.
+ *
+ * every callback runs with the board lock held and interrupts off. that's
+ * process context for client accesses and ioctls, softirq context for the
+ * model timer, and hardirq context for the waveform timer except on rt
+ * kernels. so they must not sleep, and may only touch the board through the
+ * gd_model_* calls below */
+
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/hrtimer.h>
+
+struct gd_board;
+struct gd_model;
+
+struct gd_model_ops
+{
+   /* levels of some of model->pins changed. level is the whole GPLEV word,
+    * changed the model's pins that moved */
+   void (*changed)(struct gd_model *model, u64 level, u64 changed);
+
+   /* the timer armed with gd_model_timer_start() expired. runs from a
+    * softirq hrtimer */
+   void (*timer)(struct gd_model *model);
+
+   /* the board went back to power-on state, all inputs low. a pending
+    * timer has been cancelled already. drop whatever the model remembers
+    * and drive the inputs a freshly powered part would */
+   void (*reset)(struct gd_model *model);
+};
+
+struct gd_model
+{
+   /* filled in by the model */
+   const char *name;
+   const struct gd_model_ops *ops;
+   u64 pins; // pins it watches
+   u64 drives; // pins whose inputs it drives, no two models may share one
+   void *priv;
+
+   /* gpiomem_dummy's */
+   struct list_head list;
+   struct gd_board *board; // NULL when detached
+   struct hrtimer timer;
+};
+
+int gd_model_register(struct gd_model *model);
+void gd_model_unregister(struct gd_model *model);
+
+/* callbacks only */
+void gd_model_drive(struct gd_model *model, u64 pins, u64 levels);
+u64 gd_model_level(struct gd_model *model);
+void gd_model_timer_start(struct gd_model *model, u64 delay_ns);
+void gd_model_timer_cancel(struct gd_model *model);
+
+#endif /* GPIOMEM_DUMMY_MODEL_H_GUARD */
@@ -0,0 +1,178 @@
+#include "gpiomem_dummy_pmu.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/perf_event.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+
+#include "gpiomem_dummy.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "pmu: "
+
+/* the events counting on each cpu right now, by config. perf adds and
+ * deletes them on their cpu with irqs off, we walk them under rcu */
+struct gd_pmu_cpu
+{
+   struct hlist_head events[GD_PMU_EVENTS];
+};
+
+static DEFINE_PER_CPU(struct gd_pmu_cpu, gd_pmu_cpu);
+
+atomic_t gd_pmu_nr_events = ATOMIC_INIT(0);
+
+static bool gd_pmu_registered = false;
+
+/* counts go straight into event->count, so there's nothing to fold in on
+ * read. per task events follow current, which is the client in the fault */
+void gd_pmu_count(enum gd_pmu_event ev)
+{
+   struct perf_event *event = NULL;
+
+   rcu_read_lock();
+   preempt_disable();
+
+   hlist_for_each_entry_rcu(event, &this_cpu_ptr(&gd_pmu_cpu)->events[ev], hlist_entry)
+   {
+      if(!event->hw.state)
+      {
+         local64_inc(&event->count);
+      }
+   }
+
+   preempt_enable();
+   rcu_read_unlock();
+}
+
+static struct pmu gd_pmu;
+
+static void gd_pmu_event_destroy(struct perf_event *event)
+{
+   atomic_dec(&gd_pmu_nr_events);
+}
+
+static int gd_pmu_event_init(struct perf_event *event)
+{
+   if(event->attr.type != gd_pmu.type)
+   {
+      return -ENOENT;
+   }
+
+   if(event->attr.config >= GD_PMU_EVENTS)
+   {
+      return -EINVAL;
+   }
+
+   // raising a sample needs perf_event_overflow(), which modules can't call
+   if(is_sampling_event(event) || has_branch_stack(event))
+   {
+      return -EOPNOTSUPP;
+   }
+
+   atomic_inc(&gd_pmu_nr_events);
+   event->destroy = gd_pmu_event_destroy;
+
+   return 0;
+}
+
+static void gd_pmu_start(struct perf_event *event, int flags)
+{
+   event->hw.state = 0;
+}
+
+static void gd_pmu_stop(struct perf_event *event, int flags)
+{
+   event->hw.state = PERF_HES_STOPPED | PERF_HES_UPTODATE;
+}
+
+static int gd_pmu_add(struct perf_event *event, int flags)
+{
+   struct gd_pmu_cpu *cpu = this_cpu_ptr(&gd_pmu_cpu);
+
+   event->hw.state = (flags & PERF_EF_START) ? 0 : PERF_HES_STOPPED | PERF_HES_UPTODATE;
+   hlist_add_head_rcu(&event->hlist_entry, &cpu->events[event->attr.config]);
+
+   perf_event_update_userpage(event);
+
+   return 0;
+}
+
+static void gd_pmu_del(struct perf_event *event, int flags)
+{
+   hlist_del_rcu(&event->hlist_entry);
+}
+
+static void gd_pmu_read(struct perf_event *event)
+{
+}
+
+/* so `perf stat -e gpiomem_dummy/writes/` resolves */
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *gd_pmu_format_attrs[] = {
+   &format_attr_event.attr,
+   NULL,
+};
+
+static const struct attribute_group gd_pmu_format_group = {
+   .name = "format",
+   .attrs = gd_pmu_format_attrs,
+};
+
+PMU_EVENT_ATTR_STRING(reads, gd_pmu_attr_reads, "event=0x00");
+PMU_EVENT_ATTR_STRING(writes, gd_pmu_attr_writes, "event=0x01");
+
+static struct attribute *gd_pmu_event_attrs[] = {
+   &gd_pmu_attr_reads.attr.attr,
+   &gd_pmu_attr_writes.attr.attr,
+   NULL,
+};
+
+static const struct attribute_group gd_pmu_events_group = {
+   .name = "events",
+   .attrs = gd_pmu_event_attrs,
+};
+
+static const struct attribute_group *gd_pmu_attr_groups[] = {
+   &gd_pmu_format_group,
+   &gd_pmu_events_group,
+   NULL,
+};
+
+static struct pmu gd_pmu = {
+   .module = THIS_MODULE,
+   .task_ctx_nr = perf_sw_context,
+   .capabilities = PERF_PMU_CAP_NO_INTERRUPT,
+   .attr_groups = gd_pmu_attr_groups,
+   .event_init = gd_pmu_event_init,
+   .add = gd_pmu_add,
+   .del = gd_pmu_del,
+   .start = gd_pmu_start,
+   .stop = gd_pmu_stop,
+   .read = gd_pmu_read,
+};
+
+/* clients run fine without it, so failing is only worth a message */
+int gd_pmu_init(void)
+{
+   int ret = perf_pmu_register(&gd_pmu, "gpiomem_dummy", -1);
+
+   if(ret != 0)
+   {
+      pr_err("failed to register perf pmu: %d", ret);
+      return ret;
+   }
+
+   gd_pmu_registered = true;
+
+   return 0;
+}
+
+void gd_pmu_destroy(void)
+{
+   if(gd_pmu_registered)
+   {
+      perf_pmu_unregister(&gd_pmu);
+      gd_pmu_registered = false;
+   }
+}
@@ -0,0 +1,31 @@
+#ifndef GPIOMEM_DUMMY_PMU_H_GUARD
+#define GPIOMEM_DUMMY_PMU_H_GUARD
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+
+/* perf events on the "gpiomem_dummy" pmu, attr.config */
+enum gd_pmu_event {
+   GD_PMU_READS,
+   GD_PMU_WRITES,
+   GD_PMU_EVENTS
+};
+
+extern atomic_t gd_pmu_nr_events;
+
+void gd_pmu_count(enum gd_pmu_event ev);
+
+/* an emulated access by current. one load when no event is open */
+static inline
+void gd_pmu_access(bool write)
+{
+   if(atomic_read(&gd_pmu_nr_events))
+   {
+      gd_pmu_count(write ? GD_PMU_WRITES : GD_PMU_READS);
+   }
+}
+
+int gd_pmu_init(void);
+void gd_pmu_destroy(void);
+
+#endif /* GPIOMEM_DUMMY_PMU_H_GUARD */
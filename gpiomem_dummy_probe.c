@@ -11,38 +11,192 @@
 #include <linux/rculist.h>
 #include <linux/slab.h>
 #include <linux/sched/task_stack.h>
+#include <linux/sched/task.h>
 #include <linux/uaccess.h>
 #include <asm/desc.h>
 #include <asm/mmu_context.h>
 
 #include "gpiomem_dummy.h"
+#include "gpiomem_dummy_mmap.h"
 
 #define LOG_PREFIX LOG_PREFIX_ "probe: "
 
-static int gd_up_handler(struct uprobe_consumer *self, struct pt_regs *regs);
-static bool gd_up_filter(struct uprobe_consumer *self,
-                        enum uprobe_filter_ctx ctx,
-                        struct mm_struct *mm);
-static struct uprobe_consumer gd_uprobe_consumer =
+static int gd_up_handler(GD_UPROBE_HANDLER_ARGS);
+static bool gd_up_filter(GD_UPROBE_FILTER_ARGS);
+
+static unsigned long get_next_ip(struct task_struct *task, struct gd_store_op *op);
+unsigned long insn_get_seg_base(struct pt_regs *regs, int seg_reg_idx);
+
+/* a page that was mapped for an access whose uprobe isn't installed yet. the
+ * access already went through untrapped, so once the uprobe is in place the
+ * page gets unmapped again to re-arm the trap */
+struct gd_rearm {
+   struct list_head list;
+   struct mm_struct *mm; // mmgrab'd
+   unsigned long addr;
+   unsigned int off; // the access that went through, emulated once we're done
+   bool write;
+   bool have_val;
+   u32 val; // what a write stored, decoded from the registers at fault time
+   struct task_struct *task; // who made it, get_task_struct'd
+};
+
+static inline
+unsigned long gd_probe_key(struct mm_struct *mm, unsigned long vaddr)
+{
+   return (unsigned long)mm ^ vaddr;
+}
+
+static inline
+unsigned long gd_site_key(struct inode *inode, unsigned long ip)
 {
-   .handler = gd_up_handler,
-   .filter = gd_up_filter
+   return (unsigned long)inode ^ ip;
+}
+
+/* pt_regs offsets by the register number the instruction encodes */
+static const unsigned int gd_reg_offs[] = {
+   offsetof(struct pt_regs, ax), offsetof(struct pt_regs, cx),
+   offsetof(struct pt_regs, dx), offsetof(struct pt_regs, bx),
+   offsetof(struct pt_regs, sp), offsetof(struct pt_regs, bp),
+   offsetof(struct pt_regs, si), offsetof(struct pt_regs, di),
+#ifdef CONFIG_X86_64
+   offsetof(struct pt_regs, r8), offsetof(struct pt_regs, r9),
+   offsetof(struct pt_regs, r10), offsetof(struct pt_regs, r11),
+   offsetof(struct pt_regs, r12), offsetof(struct pt_regs, r13),
+   offsetof(struct pt_regs, r14), offsetof(struct pt_regs, r15),
+#endif
 };
 
-static int get_next_ip(struct task_struct *task);
-unsigned long insn_get_seg_base(struct pt_regs *regs, int seg_reg_idx);
+static inline
+unsigned long gd_reg(struct pt_regs *regs, int reg)
+{
+   return regs_get_register(regs, gd_reg_offs[reg]);
+}
+
+/* the value op stores, going by regs. false if it's nothing we decoded */
+static bool gd_store_val(const struct gd_store_op *op, struct pt_regs *regs, u32 *val)
+{
+   switch(op->kind)
+   {
+      case GD_STORE_REG:
+         *val = (u32)gd_reg(regs, op->src);
+         return true;
+      case GD_STORE_IMM:
+         *val = op->imm;
+         return true;
+      default:
+         return false;
+   }
+}
+
+/* the user address op stores to, going by regs. 0 if we can't tell */
+static unsigned long gd_store_addr(const struct gd_store_op *op, struct pt_regs *regs)
+{
+   unsigned long addr = op->disp;
+
+   if(op->kind == GD_STORE_NONE || !op->ea)
+   {
+      return 0;
+   }
+
+   if(op->base >= 0)
+   {
+      addr += gd_reg(regs, op->base);
+   }
+
+   if(op->index >= 0)
+   {
+      addr += gd_reg(regs, op->index) << op->scale;
+   }
 
-void gd_add_probe(struct gpiomem_dummy *gd, struct gd_probe_info *task)
+   return addr;
+}
+
+/* for stores we couldn't decode, all that's left is what's in the page now */
+static u32 gd_store_fallback(struct gpiomem_dummy *gd, unsigned int off)
+{
+   if(!gd_board_reg_valid(off))
+   {
+      return 0;
+   }
+
+   return READ_ONCE(gd->board.page[off / 4]);
+}
+
+/* caller holds gd->probe_lock, returns true if the site needs unregistering */
+static bool gd_put_site_locked(struct gpiomem_dummy *gd, struct gd_probe_site *site)
 {
-   list_add_rcu(&task->list, &gd->probe_list);
+   if(--site->users > 0)
+   {
+      return false;
+   }
+
+   hash_del(&site->hnode);
+
+   // never registered yet, gd_site_work() notices and frees it
+   if(site->state == GD_SITE_PENDING)
+   {
+      return false;
+   }
+
+   list_add(&site->dead, &gd->dead_sites);
+
+   return true;
 }
 
 void gd_rem_task(struct gpiomem_dummy *gd, struct gd_probe_info *task)
 {
+   bool dead = false;
+
+   spin_lock(&gd->probe_lock);
    list_del_rcu(&task->list);
+   hash_del_rcu(&task->hnode);
+   dead = gd_put_site_locked(gd, task->site);
+   spin_unlock(&gd->probe_lock);
+
+   kfree_rcu(task, rcu);
+
+   if(dead)
+   {
+      schedule_work(&gd->site_work);
+   }
+}
+
+/* caller must hold rcu_read_lock() (or gd->probe_lock) */
+struct gd_probe_info *gd_find_probe(struct gpiomem_dummy *gd, struct mm_struct *mm, unsigned long vaddr)
+{
+   struct gd_probe_info *probe = NULL;
+
+   hash_for_each_possible_rcu(gd->probe_hash, probe, hnode, gd_probe_key(mm, vaddr))
+   {
+      if(probe->mm == mm && probe->vaddr == vaddr)
+      {
+         return probe;
+      }
+   }
+
+   return NULL;
 }
 
-struct gd_probe_info *gd_create_probe(struct task_struct *task, struct vm_area_struct *vma)
+/* caller holds gd->probe_lock */
+static struct gd_probe_site *gd_find_site_locked(struct gpiomem_dummy *gd, struct inode *inode, unsigned long ip)
+{
+   struct gd_probe_site *site = NULL;
+
+   hash_for_each_possible(gd->site_hash, site, hnode, gd_site_key(inode, ip))
+   {
+      if(site->inode == inode && site->ip == ip)
+      {
+         return site;
+      }
+   }
+
+   return NULL;
+}
+
+struct gd_probe_info *gd_create_probe(struct task_struct *task, struct vm_area_struct *vma,
+                                      unsigned long vaddr, unsigned long addr, bool write,
+                                      const struct gd_store_op *op)
 {
    struct file *task_file = NULL;
    struct gd_probe_info *info = NULL;
@@ -55,49 +209,444 @@ struct gd_probe_info *gd_create_probe(struct task_struct *task, struct vm_area_s
    }
 
    info = kcalloc(1, sizeof(*info), GFP_KERNEL);
+   if(!info)
+   {
+      pr_err("failed to allocate probe info");
+      return NULL;
+   }
 
    info->inode = task_file->f_inode;
    info->task = task;
-   info->ip = get_next_ip(task);
+   info->mm = task->mm;
+   info->vaddr = vaddr;
+   info->ip = vaddr - task->mm->start_code;
+   info->page_addr = addr & PAGE_MASK;
+   info->access_off = addr & ~PAGE_MASK;
+   info->access_write = write;
+   info->op = *op;
 
    info->vma = vma;
 
    return info;
 }
 
-int gd_register_probe(struct task_struct *task, struct vm_area_struct *vma)
+/* hook the probe up to the uprobe for its (inode, ip). a site nobody has
+ * registered yet is only queued here, gd_site_work() does the registering */
+static int gd_add_probe(struct gpiomem_dummy *gd, struct gd_probe_info *probe, bool have_val, u32 val)
+{
+   struct gd_probe_site *site = NULL, *new_site = NULL;
+   struct gd_rearm *rearm = NULL;
+   bool queue = false;
+
+   new_site = kcalloc(1, sizeof(*new_site), GFP_KERNEL);
+   rearm = kcalloc(1, sizeof(*rearm), GFP_KERNEL);
+   if(!new_site || !rearm)
+   {
+      pr_err("failed to allocate probe site");
+      kfree(new_site);
+      kfree(rearm);
+      return -ENOMEM;
+   }
+
+   spin_lock(&gd->probe_lock);
+
+   // another thread in this mm beat us to it
+   if(gd_find_probe(gd, probe->mm, probe->vaddr))
+   {
+      spin_unlock(&gd->probe_lock);
+      kfree(new_site);
+      kfree(rearm);
+      kfree(probe);
+      return 0;
+   }
+
+   site = gd_find_site_locked(gd, probe->inode, probe->ip);
+   if(!site)
+   {
+      site = new_site;
+      new_site = NULL;
+
+      site->inode = probe->inode;
+      site->ip = probe->ip;
+      site->state = GD_SITE_PENDING;
+      site->consumer.handler = gd_up_handler;
+      site->consumer.filter = gd_up_filter;
+      INIT_LIST_HEAD(&site->rearm);
+
+      hash_add(gd->site_hash, &site->hnode, gd_site_key(site->inode, site->ip));
+      list_add_tail(&site->pending, &gd->pending_sites);
+      queue = true;
+   }
+
+   site->users++;
+   probe->site = site;
+
+   list_add_rcu(&probe->list, &gd->probe_list);
+   hash_add_rcu(gd->probe_hash, &probe->hnode, gd_probe_key(probe->mm, probe->vaddr));
+
+   if(site->state == GD_SITE_PENDING)
+   {
+      mmgrab(probe->mm);
+      rearm->mm = probe->mm;
+      rearm->addr = probe->page_addr;
+      rearm->off = probe->access_off;
+      rearm->write = probe->access_write;
+      rearm->have_val = have_val;
+      rearm->val = val;
+      rearm->task = get_task_struct(current);
+      list_add(&rearm->list, &site->rearm);
+      rearm = NULL;
+   }
+
+   spin_unlock(&gd->probe_lock);
+
+   if(queue)
+   {
+      schedule_work(&gd->site_work);
+   }
+
+   kfree(new_site);
+   kfree(rearm);
+
+   return 0;
+}
+
+/* called on fault with nothing more than the vma (or mmap_sem for read) held,
+ * so it must never need the mm-wide lock. a site we've seen before is one rcu
+ * hash lookup, a new one is queued for gd_site_work(). forked children end up
+ * here too and set up their own probes lazily on their first fault. start is
+ * when the fault began, for the profile */
+int gd_register_probe(struct task_struct *task, struct vm_area_struct *vma, unsigned long addr, bool write, u64 start)
 {
+   struct gpiomem_dummy *gd = gd_get_from_vma(vma);
    struct gd_probe_info *probe = NULL;
-   int upret = 0;
+   struct gd_store_op op;
+   unsigned long vaddr = 0;
+   u64 decode_start = 0;
+   bool have_val = false;
+   u32 val = 0;
+
+   decode_start = gd_lat_start(&gd->lat);
+   vaddr = get_next_ip(task, &op);
+   gd_lat_end(&gd->lat, GD_LAT_DECODE, decode_start);
+   if(!vaddr)
+   {
+      return -EFAULT;
+   }
+
+   if(start && task->mm->exe_file)
+   {
+      gd_prof_fault(&gd->prof, task->mm->exe_file, vaddr - task->mm->start_code, write, start);
+   }
 
-   probe = gd_create_probe(task, vma);
+   // same access site hit again, the uprobe is already in place
+   rcu_read_lock();
+   probe = gd_find_probe(gd, task->mm, vaddr);
+   if(probe)
+   {
+      // threads racing on one site in one mm almost always hit the same register
+      WRITE_ONCE(probe->page_addr, addr & PAGE_MASK);
+      WRITE_ONCE(probe->access_off, addr & ~PAGE_MASK);
+      WRITE_ONCE(probe->access_write, write);
+      WRITE_ONCE(probe->fault_ns, gd_lat_start(&gd->lat));
+   }
+   rcu_read_unlock();
+
+   if(probe)
+   {
+      return 0;
+   }
+
+   probe = gd_create_probe(task, vma, vaddr, addr, write, &op);
    if (!probe)
    {
       return -ENOMEM;
    }
 
-   upret = uprobe_register(probe->inode, probe->ip, &gd_uprobe_consumer);
-   if (upret != 0)
+   // the store hasn't happened yet, but a mov leaves its source alone, so
+   // this is what it's going to write. for the rearm in gd_site_work()
+   have_val = gd_store_val(&op, task_pt_regs(task), &val);
+
+   return gd_add_probe(gd, probe, have_val, val);
+}
+
+/* drop every probe belonging to mm. called from mmap_close(), which may hold
+ * mmap_sem, so the actual uprobe_unregister is left to gd_site_work() */
+void gd_remove_mm_probes(struct gpiomem_dummy *gd, struct mm_struct *mm)
+{
+   struct gd_probe_info *probe = NULL, *tmp = NULL;
+   bool dead = false;
+
+   spin_lock(&gd->probe_lock);
+   list_for_each_entry_safe(probe, tmp, &gd->probe_list, list)
    {
-      pr_err("failed to register uprobe: %d\n", upret);
-      pr_err("ip=%lx, inode.i_bytes=%d", probe->ip, probe->inode->i_bytes);
-      return -ENOMEM;
+      if(probe->mm != mm)
+      {
+         continue;
+      }
+
+      list_del_rcu(&probe->list);
+      hash_del_rcu(&probe->hnode);
+      dead |= gd_put_site_locked(gd, probe->site);
+      kfree_rcu(probe, rcu);
    }
+   spin_unlock(&gd->probe_lock);
 
-   pr_info("uprobe_register done");
+   if(dead)
+   {
+      schedule_work(&gd->site_work);
+   }
+}
 
-   gd_add_probe(gd_get_from_vma(vma), probe);
+/* caller holds gd->probe_lock */
+static void gd_drop_site_probes_locked(struct gpiomem_dummy *gd, struct gd_probe_site *site)
+{
+   struct gd_probe_info *probe = NULL, *tmp = NULL;
 
-   return 0;
+   list_for_each_entry_safe(probe, tmp, &gd->probe_list, list)
+   {
+      if(probe->site != site)
+      {
+         continue;
+      }
+
+      list_del_rcu(&probe->list);
+      hash_del_rcu(&probe->hnode);
+      kfree_rcu(probe, rcu);
+   }
+
+   site->users = 0;
+}
+
+static void gd_do_rearms(struct gpiomem_dummy *gd, struct list_head *rearms)
+{
+   struct gd_rearm *rearm = NULL, *tmp = NULL;
+
+   list_for_each_entry_safe(rearm, tmp, rearms, list)
+   {
+      if(mmget_not_zero(rearm->mm))
+      {
+         gd_mmap_rearm(rearm->mm, rearm->addr);
+         mmput(rearm->mm);
+      }
+
+      if(rearm->write && !rearm->have_val)
+      {
+         rearm->val = gd_store_fallback(gd, rearm->off);
+      }
+
+      gd_board_trap_end(&gd->board, rearm->off, rearm->write, rearm->val, rearm->task);
+
+      put_task_struct(rearm->task);
+      mmdrop(rearm->mm);
+      list_del(&rearm->list);
+      kfree(rearm);
+   }
+}
+
+/* installs queued uprobes and unregisters unused ones. uprobe_register and
+ * uprobe_unregister take mmap_sem for write on every mm mapping the binary,
+ * which is exactly what the fault path mustn't wait on */
+void gd_site_work(struct work_struct *work)
+{
+   struct gpiomem_dummy *gd = container_of(work, struct gpiomem_dummy, site_work);
+   struct gd_probe_site *site = NULL, *tmp = NULL;
+   LIST_HEAD(sites);
+   LIST_HEAD(rearms);
+   int upret = 0;
+
+   for(;;)
+   {
+      spin_lock(&gd->probe_lock);
+      site = list_first_entry_or_null(&gd->pending_sites, struct gd_probe_site, pending);
+      if(site)
+      {
+         list_del_init(&site->pending);
+      }
+      spin_unlock(&gd->probe_lock);
+
+      if(!site)
+      {
+         break;
+      }
+
+      upret = -ENOENT;
+      if(READ_ONCE(site->users) > 0)
+      {
+         u64 start = gd_lat_start(&gd->lat);
+
+         upret = gd_uprobe_register(site->inode, site->ip, &site->consumer, &site->uprobe);
+         gd_lat_end(&gd->lat, GD_LAT_UPROBE_REG, start);
+         if (upret != 0)
+         {
+            pr_err("failed to register uprobe: %d\n", upret);
+            pr_err("ip=%lx, inode.i_bytes=%d", site->ip, site->inode->i_bytes);
+         }
+         else
+         {
+            pr_debug("uprobe_register done");
+         }
+      }
+
+      spin_lock(&gd->probe_lock);
+      list_splice_init(&site->rearm, &rearms);
+      if(upret == 0)
+      {
+         site->state = GD_SITE_INSTALLED;
+         if(site->users == 0)
+         {
+            list_add(&site->dead, &gd->dead_sites);
+         }
+      }
+      else
+      {
+         // forget its probes too, so the next fault at this site starts over
+         gd_drop_site_probes_locked(gd, site);
+         hash_del(&site->hnode);
+      }
+      spin_unlock(&gd->probe_lock);
+
+      gd_do_rearms(gd, &rearms);
+
+      if(upret != 0)
+      {
+         kfree(site);
+      }
+   }
+
+   spin_lock(&gd->probe_lock);
+   list_splice_init(&gd->dead_sites, &sites);
+   spin_unlock(&gd->probe_lock);
+
+   // waits out any handler still running on this consumer
+   list_for_each_entry_safe(site, tmp, &sites, dead)
+   {
+      gd_uprobe_unregister(site->inode, site->ip, &site->consumer, site->uprobe);
+      list_del(&site->dead);
+      kfree(site);
+   }
 }
 
-static int get_next_ip(struct task_struct *task)
+void gd_remove_probes(struct gpiomem_dummy *gd)
+{
+   struct gd_probe_info *probe = NULL, *tmp = NULL;
+   LIST_HEAD(dead);
+
+   spin_lock(&gd->probe_lock);
+   list_for_each_entry(probe, &gd->probe_list, list)
+   {
+      hash_del_rcu(&probe->hnode);
+      gd_put_site_locked(gd, probe->site);
+   }
+   // lookups only ever walk the hash, so the list can be taken over directly
+   list_splice_init(&gd->probe_list, &dead);
+   spin_unlock(&gd->probe_lock);
+
+   flush_work(&gd->site_work);
+   gd_site_work(&gd->site_work);
+
+   synchronize_rcu();
+
+   list_for_each_entry_safe(probe, tmp, &dead, list)
+   {
+      list_del(&probe->list);
+      kfree(probe);
+   }
+}
+
+/* fill op from a decoded instruction at user address next_ip - insn->length.
+ * only plain 32 bit movs, which is what a volatile u32 store compiles to */
+static void gd_decode_store(struct insn *insn, unsigned long next_ip, struct gd_store_op *op)
+{
+   u8 modrm = insn->modrm.value;
+   u8 sib = insn->sib.value;
+   u8 rex = insn->rex_prefix.value;
+   int rm = X86_MODRM_RM(modrm);
+   int i;
+
+   memset(op, 0, sizeof(*op));
+   op->kind = GD_STORE_NONE;
+   op->base = -1;
+   op->index = -1;
+
+   if(insn->opcode.nbytes != 1 || insn->opnd_bytes != 4 || X86_MODRM_MOD(modrm) == 3)
+   {
+      return;
+   }
+
+   switch(insn->opcode.bytes[0])
+   {
+      case 0x89:
+         op->kind = GD_STORE_REG;
+         op->src = X86_MODRM_REG(modrm) | (X86_REX_R(rex) ? 8 : 0);
+         break;
+      case 0xc7:
+         if(X86_MODRM_REG(modrm) != 0)
+         {
+            return;
+         }
+         op->kind = GD_STORE_IMM;
+         op->imm = (u32)insn->immediate.value;
+         break;
+      default:
+         return;
+   }
+
+   // fs/gs relative or 32 bit addressing, leave those to the fault address
+   if(!insn->x86_64 || insn->addr_bytes != 8)
+   {
+      return;
+   }
+
+   for(i = 0; i < insn->prefixes.nbytes; i++)
+   {
+      if(insn->prefixes.bytes[i] == 0x64 || insn->prefixes.bytes[i] == 0x65)
+      {
+         return;
+      }
+   }
+
+   op->disp = insn->displacement.value;
+
+   if(rm == 4)
+   {
+      int base = X86_SIB_BASE(sib) | (X86_REX_B(rex) ? 8 : 0);
+      int index = X86_SIB_INDEX(sib) | (X86_REX_X(rex) ? 8 : 0);
+
+      // base 5 without a displacement byte means disp32 and no base
+      if(!(X86_MODRM_MOD(modrm) == 0 && X86_SIB_BASE(sib) == 5))
+      {
+         op->base = base;
+      }
+
+      if(index != 4)
+      {
+         op->index = index;
+         op->scale = X86_SIB_SCALE(sib);
+      }
+   }
+   else if(X86_MODRM_MOD(modrm) == 0 && rm == 5)
+   {
+      op->disp += next_ip;
+   }
+   else
+   {
+      op->base = rm | (X86_REX_B(rex) ? 8 : 0);
+   }
+
+   op->ea = true;
+}
+
+/* returns the user address of the instruction following the faulting one,
+ * or 0 if it couldn't be decoded. op says what it stores, if anything */
+static unsigned long get_next_ip(struct task_struct *task, struct gd_store_op *op)
 {
    struct pt_regs *pt_regs = NULL;
    struct insn insn;
    char insn_buff[32];
    unsigned long seg_base = 0;
-   int not_copied, nr_copied;
+   unsigned long addr = 0;
+   int nr_copied;
    unsigned long ip = 0;
 
    pt_regs = task_pt_regs(task);
@@ -113,21 +662,33 @@ static int get_next_ip(struct task_struct *task)
    if (seg_base == -1L)
    {
       pr_err("failed to get seg_base");
-      return VM_FAULT_ERROR;
+      return 0;
    }
 
-   not_copied = copy_from_user(insn_buff, (void __user *)(seg_base + pt_regs->ip), sizeof(insn_buff));
-   nr_copied = sizeof(insn_buff) - not_copied;
+   /*
+   * We're in the fault path, possibly holding only the vma lock, so don't
+   * fault the text in (that would want mmap_sem). It was executed from a
+   * moment ago, so it's there unless the read runs off the end of the
+   * mapping, in which case stick to the current page.
+   */
+   addr = seg_base + pt_regs->ip;
+   nr_copied = sizeof(insn_buff);
+   if (copy_from_user_nofault(insn_buff, (void __user *)addr, nr_copied))
+   {
+      nr_copied = min_t(int, nr_copied, PAGE_SIZE - offset_in_page(addr));
+      if (copy_from_user_nofault(insn_buff, (void __user *)addr, nr_copied))
+         nr_copied = 0;
+   }
 
    /*
-   * The copy_from_user above could have failed if user code is protected
+   * The copy above could have failed if user code is protected
    * by a memory protection key. Give up on this in such a case.
    * Should we issue a page fault?
    */
    if (!nr_copied)
    {
       pr_err("failed to copy instruction from userspace");
-      return VM_FAULT_ERROR;
+      return 0;
    }
 
    insn_init(&insn, insn_buff, nr_copied, user_64bit_mode(pt_regs));
@@ -136,23 +697,29 @@ static int get_next_ip(struct task_struct *task)
    if (nr_copied < insn.length)
    {
       pr_err("failed to get instruction length");
-      return VM_FAULT_ERROR;
+      return 0;
    }
 
 
-   ip = (pt_regs->ip + insn.length) - task->mm->start_code;
+   ip = pt_regs->ip + insn.length;
 
+   gd_decode_store(&insn, seg_base + ip, op);
 
-   pr_info("ip=%lx insn.length=%hhu start_code=%lx", ip, insn.length, task->mm->start_code);
+   pr_debug("ip=%lx insn.length=%hhu start_code=%lx", ip, insn.length, task->mm->start_code);
 
    return ip;
 }
 
-static int gd_up_handler(struct uprobe_consumer *self, struct pt_regs *regs)
+static int gd_up_handler(GD_UPROBE_HANDLER_ARGS)
 {
    struct gpiomem_dummy *gd = gd_get();
-
-   pr_info("in uprobe handler!");
+   struct gd_probe_site *site = container_of(self, struct gd_probe_site, consumer);
+   struct gd_probe_info *probe = NULL;
+   unsigned long page_addr = 0, addr = 0;
+   unsigned int off = 0;
+   bool write = false;
+   u32 val = 0;
+   u64 handler_start = 0, prof_start = 0, fault_ns = 0, start = 0;
 
    if(!gd)
    {
@@ -160,28 +727,74 @@ static int gd_up_handler(struct uprobe_consumer *self, struct pt_regs *regs)
       return -ENOMEM;
    }
 
-   /*rcu_read_lock();
-   list_for_each_entry_rcu(probe, &gd->probe_list, list)
+   handler_start = gd_lat_start(&gd->lat);
+   prof_start = gd_prof_start(&gd->prof);
+
+   // handle_swbp() rewinds regs->ip to the probed address before calling us
+   rcu_read_lock();
+   probe = gd_find_probe(gd, current->mm, instruction_pointer(regs));
+   if(probe)
    {
-      if(probe->ip = regs->ip)
+      pr_debug("got probe! ip=%lx", probe->ip);
+      page_addr = READ_ONCE(probe->page_addr);
+      off = READ_ONCE(probe->access_off);
+      write = READ_ONCE(probe->access_write);
+      fault_ns = READ_ONCE(probe->fault_ns);
+
+      // the fields above are whichever thread faulted here last, our own
+      // registers say what this thread did
+      addr = gd_store_addr(&probe->op, regs);
+      if(addr)
       {
-         pr_info("got probe!");
+         page_addr = addr & PAGE_MASK;
+         off = addr & ~PAGE_MASK;
+         write = true;
+      }
 
+      if(write && !gd_store_val(&probe->op, regs, &val))
+      {
+         val = gd_store_fallback(gd, off);
       }
    }
+   else
+   {
+      // a forked child that inherited the breakpoint before faulting on its own
+      pr_debug("no probe for this mm at site ip=%lx", site->ip);
+   }
    rcu_read_unlock();
-   */
 
-   gd_set_page_ro(gd->page);
+   // it may have inherited the gpio page mapped too, if another thread of
+   // the parent was mid access when it forked. don't let it keep it
+   if(!probe)
+   {
+      gd_mmap_rearm_all(current->mm);
+   }
+
+   // the access has gone through, emulate it and unmap the page again so the next one traps
+   if(page_addr)
+   {
+      gd_lat_end(&gd->lat, GD_LAT_ROUNDTRIP, fault_ns);
+
+      start = gd_lat_start(&gd->lat);
+      gd_board_trap_end(&gd->board, off, write, val, current);
+      gd_lat_end(&gd->lat, GD_LAT_TRAP_END, start);
+
+      start = gd_lat_start(&gd->lat);
+      gd_mmap_rearm(current->mm, page_addr);
+      gd_lat_end(&gd->lat, GD_LAT_REARM, start);
+   }
 
+   gd_lat_end(&gd->lat, GD_LAT_HANDLER, handler_start);
+
+   if(page_addr)
+   {
+      gd_prof_handler(&gd->prof, site->inode, site->ip, prof_start);
+   }
    return 0;
 }
 
-static bool gd_up_filter(struct uprobe_consumer *self,
-                 enum uprobe_filter_ctx ctx,
-                 struct mm_struct *mm)
+static bool gd_up_filter(GD_UPROBE_FILTER_ARGS)
 {
-   pr_info("up filter: ctx=%d", ctx);
    return 1;
 }
 
@@ -2,28 +2,93 @@
 #define GPIOMEM_DUMMY_PROBE_H_GUARD
 
 #include <linux/list.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/mm_types.h>
 #include <linux/fs.h>
 #include <linux/perf_event.h>
+#include <linux/uprobes.h>
+#include <linux/workqueue.h>
+
+#include "gpiomem_dummy_compat.h"
+
+// probes are looked up by (mm, vaddr) from the uprobe handler
+#define GD_PROBE_HASH_BITS 8
 
 struct gpiomem_dummy;
+
+/* one uprobe per (inode, offset). forked children and other processes
+ * running the same binary share it, each with their own gd_probe_info. */
+enum gd_site_state {
+   GD_SITE_PENDING, // queued for gd_site_work() to uprobe_register
+   GD_SITE_INSTALLED,
+};
+
+struct gd_probe_site {
+   struct hlist_node hnode; // gd->site_hash bucket
+   struct list_head pending; // gd->pending_sites, waiting for uprobe_register
+   struct list_head dead; // gd->dead_sites, waiting for uprobe_unregister
+   struct list_head rearm; // gd_rearm's to run once the uprobe is in
+   struct uprobe_consumer consumer;
+   gd_uprobe_t uprobe; // handle for unregistering on kernels that hand one out
+   struct inode *inode;
+   unsigned long ip;
+   enum gd_site_state state; // under gd->probe_lock
+   int users; // gd_probe_info's using this site, under gd->probe_lock
+};
+
+/* what the trapped instruction stores, decoded once per site so the handler
+ * can work the access out from its own registers. the shared page may have
+ * been resynced by then, and another thread may have faulted on the site */
+enum gd_store_kind {
+   GD_STORE_NONE, // a load, or nothing we know how to decode
+   GD_STORE_REG, // mov r/m32, r32
+   GD_STORE_IMM, // mov r/m32, imm32
+};
+
+struct gd_store_op {
+   enum gd_store_kind kind;
+   s8 src; // source register for GD_STORE_REG
+   bool ea; // the address below can be worked out from registers
+   s8 base, index; // -1 when not used
+   u8 scale;
+   long disp; // rip relative ones already have the next ip added
+   u32 imm;
+};
+
 struct gd_probe_info {
    struct list_head list; // list pointers
+   struct hlist_node hnode; // gd->probe_hash bucket
+   struct rcu_head rcu;
 
    // what do we want here??
-   unsigned long ip;
+   unsigned long ip; // offset from mm->start_code, what uprobe_register wants
+   unsigned long vaddr; // user address of the probed instruction
+   struct mm_struct *mm;
    struct inode *inode;
    struct task_struct *task;
    struct vm_area_struct *vma; // ??
    struct perf_event *perf_event;
+   struct gd_probe_site *site;
+   unsigned long page_addr; // user address of the gpio page this site last faulted on
+   unsigned int access_off; // register offset of the last trapped access
+   bool access_write;
+   u64 fault_ns; // ktime_get_ns() at the end of that fault, 0 when not timing
+   struct gd_store_op op; // the same for every fault at this site
 };
 
-struct gd_probe_info *gd_create_probe(struct task_struct *task, struct vm_area_struct *vma);
+struct gd_probe_info *gd_create_probe(struct task_struct *task, struct vm_area_struct *vma,
+                                      unsigned long vaddr, unsigned long addr, bool write,
+                                      const struct gd_store_op *op);
+
 
+int gd_register_probe(struct task_struct *task, struct vm_area_struct *vma, unsigned long addr, bool write, u64 start);
 
-int gd_register_probe(struct task_struct *task, struct vm_area_struct *vma);
+struct gd_probe_info *gd_find_probe(struct gpiomem_dummy *gd, struct mm_struct *mm, unsigned long vaddr);
 
-void gd_add_probe(struct gpiomem_dummy *gd, struct gd_probe_info *probe);
+void gd_remove_mm_probes(struct gpiomem_dummy *gd, struct mm_struct *mm);
+void gd_remove_probes(struct gpiomem_dummy *gd);
+void gd_site_work(struct work_struct *work);
 
 #endif /* GPIOMEM_DUMMY_PROBE_H_GUARD */
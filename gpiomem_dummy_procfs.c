@@ -6,6 +6,7 @@
 #include <linux/uaccess.h>
 
 #include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
 
 #define LOG_PREFIX LOG_PREFIX_ "proc: "
 
@@ -20,14 +21,21 @@ static void range_set(u8 *data, int idx, u32 val)
    data[idx*4+3] = (u8)(val & 0xff);
 }
 
-static ssize_t proc_read(struct file *filp, char *buf, size_t count, loff_t *offp);
+static ssize_t proc_read(struct file *filp, char __user *buf, size_t count, loff_t *offp);
 static loff_t proc_llseek(struct file *filp, loff_t offset, int whence);
 
-static struct file_operations proc_fops = {
+#ifdef GD_HAVE_PROC_OPS
+static const struct proc_ops proc_fops = {
+   .proc_read = proc_read, // read from our device tree ranges file
+   .proc_lseek = proc_llseek // seek!
+};
+#else
+static const struct file_operations proc_fops = {
    .owner = THIS_MODULE, // WE OWN YOU
    .read = proc_read, // read from our device tree ranges file
    .llseek = proc_llseek // seek!
 };
+#endif
 
 #define my_min(a, b) ({ \
 typeof ((a)) a_copy_ = (a); \
@@ -146,7 +154,7 @@ void gpiomem_dummy_procfs_destroy(struct gpiomem_dummy_procfs *pfs)
    }
 }
 
-ssize_t proc_read(struct file *filp, char *buf, size_t count, loff_t *offp)
+static ssize_t proc_read(struct file *filp, char __user *buf, size_t count, loff_t *offp)
 {
    ssize_t to_copy = count;
    ssize_t ctu_ret = 0;
@@ -160,7 +168,7 @@ ssize_t proc_read(struct file *filp, char *buf, size_t count, loff_t *offp)
       return 0;
    }
 
-   pfs = PDE_DATA(filp->f_inode);
+   pfs = pde_data(filp->f_inode);
    if(!pfs)
    {
       printk(KERN_ERR LOG_PREFIX "Failed to find pde data in file handle\n");
@@ -205,7 +213,7 @@ const char *whence_str[] = {
    "SEEK_SET", "SEEK_CUR", "SEEK_END", NULL
 };
 
-loff_t proc_llseek(struct file *filp, loff_t offset, int whence)
+static loff_t proc_llseek(struct file *filp, loff_t offset, int whence)
 {
    return fixed_size_llseek(filp, offset, whence, RANGES_SIZE);
 }
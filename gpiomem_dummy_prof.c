@@ -0,0 +1,275 @@
+#include "gpiomem_dummy_prof.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/math64.h>
+
+#include "gpiomem_dummy.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "prof: "
+
+static inline
+unsigned long gd_prof_key(dev_t dev, unsigned long ino, unsigned long ip)
+{
+   return ino ^ ip ^ dev;
+}
+
+/* caller must hold rcu_read_lock() (or prof->lock) */
+static struct gd_prof_site *gd_prof_find(struct gd_prof *prof, dev_t dev, unsigned long ino, unsigned long ip)
+{
+   struct gd_prof_site *site = NULL;
+
+   hash_for_each_possible_rcu(prof->table, site, hnode, gd_prof_key(dev, ino, ip))
+   {
+      if(site->dev == dev && site->ino == ino && site->ip == ip)
+      {
+         return site;
+      }
+   }
+
+   return NULL;
+}
+
+static void gd_prof_free(struct gd_prof_site *site)
+{
+   kfree(site->path);
+   kfree(site);
+}
+
+static void gd_prof_free_rcu(struct rcu_head *rcu)
+{
+   gd_prof_free(container_of(rcu, struct gd_prof_site, rcu));
+}
+
+/* sites only go away on reset, so the counting is done under rcu */
+static bool gd_prof_account(struct gd_prof *prof, dev_t dev, unsigned long ino, unsigned long ip,
+                            u64 reads, u64 writes, u64 ns)
+{
+   struct gd_prof_site *site = NULL;
+
+   rcu_read_lock();
+   site = gd_prof_find(prof, dev, ino, ip);
+   if(site)
+   {
+      atomic64_add(reads, &site->reads);
+      atomic64_add(writes, &site->writes);
+      atomic64_add(ns, &site->ns);
+   }
+   rcu_read_unlock();
+
+   return site != NULL;
+}
+
+/* a new site, named after exe. only the first access at each site gets here */
+static bool gd_prof_add(struct gd_prof *prof, struct file *exe, dev_t dev, unsigned long ino, unsigned long ip)
+{
+   struct gd_prof_site *site = NULL, *new_site = NULL;
+   char *buf = NULL, *path = NULL;
+
+   new_site = kzalloc(sizeof(*new_site), GFP_KERNEL);
+   buf = kmalloc(PATH_MAX, GFP_KERNEL);
+   if(!new_site || !buf)
+   {
+      kfree(new_site);
+      kfree(buf);
+      return false;
+   }
+
+   path = d_path(&exe->f_path, buf, PATH_MAX);
+   new_site->path = kstrdup(IS_ERR(path) ? "?" : path, GFP_KERNEL);
+   kfree(buf);
+   if(!new_site->path)
+   {
+      kfree(new_site);
+      return false;
+   }
+
+   new_site->dev = dev;
+   new_site->ino = ino;
+   new_site->ip = ip;
+
+   spin_lock(&prof->lock);
+
+   // another thread beat us to it
+   site = gd_prof_find(prof, dev, ino, ip);
+   if(!site && prof->count < GD_PROF_MAX)
+   {
+      site = new_site;
+      new_site = NULL;
+      hash_add_rcu(prof->table, &site->hnode, gd_prof_key(dev, ino, ip));
+      prof->count++;
+   }
+
+   spin_unlock(&prof->lock);
+
+   if(new_site)
+   {
+      gd_prof_free(new_site);
+   }
+
+   return site != NULL;
+}
+
+/* an access at ip in exe trapped, and start is when. called from the fault
+ * once the access site is known, so all it still has to do is set up its
+ * probe */
+void gd_prof_fault(struct gd_prof *prof, struct file *exe, unsigned long ip, bool write, u64 start)
+{
+   struct inode *inode = file_inode(exe);
+   dev_t dev = inode->i_sb->s_dev;
+   u64 ns = 0;
+
+   if(!start)
+   {
+      return;
+   }
+
+   ns = ktime_get_ns() - start;
+
+   if(gd_prof_account(prof, dev, inode->i_ino, ip, !write, write, ns))
+   {
+      return;
+   }
+
+   // a reset between adding and counting loses the access, like any other
+   // access racing a reset
+   if(!gd_prof_add(prof, exe, dev, inode->i_ino, ip) ||
+      !gd_prof_account(prof, dev, inode->i_ino, ip, !write, write, ns))
+   {
+      atomic64_inc(&prof->dropped);
+   }
+}
+
+/* the uprobe handler for that access is done, it started at start */
+void gd_prof_handler(struct gd_prof *prof, struct inode *inode, unsigned long ip, u64 start)
+{
+   if(!start)
+   {
+      return;
+   }
+
+   gd_prof_account(prof, inode->i_sb->s_dev, inode->i_ino, ip, 0, 0, ktime_get_ns() - start);
+}
+
+void gd_prof_init(struct gd_prof *prof)
+{
+   memset(prof, 0, sizeof(*prof));
+   spin_lock_init(&prof->lock);
+   hash_init(prof->table);
+}
+
+void gd_prof_reset(struct gd_prof *prof)
+{
+   struct gd_prof_site *site = NULL;
+   struct hlist_node *tmp = NULL;
+   unsigned int bkt;
+
+   spin_lock(&prof->lock);
+
+   hash_for_each_safe(prof->table, bkt, tmp, site, hnode)
+   {
+      hash_del_rcu(&site->hnode);
+      call_rcu(&site->rcu, gd_prof_free_rcu);
+   }
+
+   prof->count = 0;
+   atomic64_set(&prof->dropped, 0);
+
+   spin_unlock(&prof->lock);
+}
+
+void gd_prof_destroy(struct gd_prof *prof)
+{
+   gd_prof_reset(prof);
+   rcu_barrier();
+}
+
+struct gd_prof_row
+{
+   u64 ns;
+   u64 reads;
+   u64 writes;
+   struct gd_prof_site *site;
+};
+
+static int gd_prof_row_cmp(const void *a, const void *b)
+{
+   const struct gd_prof_row *ra = a, *rb = b;
+
+   if(ra->ns != rb->ns)
+   {
+      return ra->ns < rb->ns ? 1 : -1;
+   }
+
+   return (ra->reads + ra->writes) < (rb->reads + rb->writes) ? 1 : -1;
+}
+
+/* the table, hottest site first. the lock keeps reset from freeing the rows'
+ * sites while they're printed */
+static int gd_prof_show(struct seq_file *m, void *v)
+{
+   struct gd_prof *prof = m->private;
+   struct gd_prof_site *site = NULL;
+   struct gd_prof_row *rows = NULL;
+   unsigned int bkt, n = 0, i;
+
+   rows = vmalloc(array_size(GD_PROF_MAX, sizeof(*rows)));
+   if(!rows)
+   {
+      return -ENOMEM;
+   }
+
+   spin_lock(&prof->lock);
+
+   hash_for_each(prof->table, bkt, site, hnode)
+   {
+      rows[n].ns = atomic64_read(&site->ns);
+      rows[n].reads = atomic64_read(&site->reads);
+      rows[n].writes = atomic64_read(&site->writes);
+      rows[n].site = site;
+      n++;
+   }
+
+   sort(rows, n, sizeof(*rows), gd_prof_row_cmp, NULL);
+
+   seq_printf(m, "enabled %d\nsites %u\ndropped %lld\n\n", prof->enabled, n, atomic64_read(&prof->dropped));
+   seq_puts(m, "ns reads writes ns_per_access ip binary\n");
+
+   for(i = 0; i < n; i++)
+   {
+      u64 count = rows[i].reads + rows[i].writes;
+
+      seq_printf(m, "%llu %llu %llu %llu 0x%lx %s\n", rows[i].ns, rows[i].reads, rows[i].writes,
+                 count ? div64_u64(rows[i].ns, count) : 0, rows[i].site->ip, rows[i].site->path);
+   }
+
+   spin_unlock(&prof->lock);
+
+   vfree(rows);
+   return 0;
+}
+
+static int gd_prof_open(struct inode *inode, struct file *filep)
+{
+   return single_open(filep, gd_prof_show, inode->i_private);
+}
+
+static const struct file_operations gd_prof_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_prof_open,
+   .read = seq_read,
+   .llseek = seq_lseek,
+   .release = single_release,
+};
+
+void gd_prof_debugfs(struct gd_prof *prof, struct dentry *dir)
+{
+   debugfs_create_bool("profile_enable", 0600, dir, &prof->enabled);
+   debugfs_create_file("profile", 0400, dir, prof, &gd_prof_fops);
+}
@@ -0,0 +1,64 @@
+#ifndef GPIOMEM_DUMMY_PROF_H_GUARD
+#define GPIOMEM_DUMMY_PROF_H_GUARD
+
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/hashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/fs.h>
+#include <linux/dcache.h>
+
+#define GD_PROF_HASH_BITS 8
+#define GD_PROF_MAX 4096 // sites tracked, later ones are only counted as dropped
+
+/* one access site in client code: the binary (by device and inode, so it
+ * survives the uprobe site going away) and the ip relative to its start_code */
+struct gd_prof_site
+{
+   struct hlist_node hnode; // prof->table
+   struct rcu_head rcu;
+   dev_t dev;
+   unsigned long ino;
+   unsigned long ip;
+   char *path; // the binary, as it was named when first seen
+   atomic64_t reads;
+   atomic64_t writes;
+   atomic64_t ns; // time spent trapping its accesses, fault plus handler
+};
+
+/* which client code generates the hardware accesses. switched with debugfs
+ * profile_enable, dumped hottest first from profile */
+struct gd_prof
+{
+   bool enabled;
+   spinlock_t lock; // table writers, lookups use rcu
+   DECLARE_HASHTABLE(table, GD_PROF_HASH_BITS);
+   unsigned int count; // sites in table
+   atomic64_t dropped; // accesses at sites that didn't fit
+};
+
+static inline
+bool gd_prof_enabled(struct gd_prof *prof)
+{
+   return READ_ONCE(prof->enabled);
+}
+
+/* when the fault began, 0 if nobody profiles */
+static inline
+u64 gd_prof_start(struct gd_prof *prof)
+{
+   return gd_prof_enabled(prof) ? ktime_get_ns() : 0;
+}
+
+void gd_prof_init(struct gd_prof *prof);
+void gd_prof_destroy(struct gd_prof *prof);
+void gd_prof_reset(struct gd_prof *prof);
+void gd_prof_debugfs(struct gd_prof *prof, struct dentry *dir);
+
+void gd_prof_fault(struct gd_prof *prof, struct file *exe, unsigned long ip, bool write, u64 start);
+void gd_prof_handler(struct gd_prof *prof, struct inode *inode, unsigned long ip, u64 start);
+
+#endif /* GPIOMEM_DUMMY_PROF_H_GUARD */
@@ -0,0 +1,650 @@
+#include "gpiomem_dummy_record.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "record: "
+
+static unsigned int record_buf_kb = 1024;
+module_param(record_buf_kb, uint, 0644);
+MODULE_PARM_DESC(record_buf_kb, "record buffer size in KiB (rounded down to a power of two), a reader further behind loses records");
+
+static unsigned int replay_entries = 65536;
+module_param(replay_entries, uint, 0444);
+MODULE_PARM_DESC(replay_entries, "gplev values replay can queue ahead of the client");
+
+// replay takes the recording in chunks this big. with the carried over part
+// of the previous one they decode to at most a quarter as many values (the
+// shortest record is 4 bytes)
+#define GD_REPLAY_CHUNK 1024
+#define GD_REPLAY_ROOM ((GD_REC_MAX + GD_REPLAY_CHUNK) / 4)
+
+static inline
+struct gd_board *gd_record_board(struct gd_record *rec)
+{
+   return container_of(rec, struct gd_board, record);
+}
+
+static inline
+struct gd_board *gd_replay_board(struct gd_replay *rp)
+{
+   return container_of(rp, struct gd_board, replay);
+}
+
+static inline
+u8 *gd_rec_put(u8 *p, u64 v)
+{
+   while(v >= 0x80)
+   {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+   }
+
+   *p++ = v;
+   return p;
+}
+
+/* -EAGAIN if the varint runs past end */
+static int gd_rec_get(const u8 **p, const u8 *end, u64 *v)
+{
+   const u8 *q = *p;
+   unsigned int shift = 0;
+   u64 val = 0;
+
+   while(q < end)
+   {
+      u8 b = *q++;
+
+      if(shift > 63)
+      {
+         return -EINVAL;
+      }
+
+      val |= (u64)(b & 0x7f) << shift;
+      if(!(b & 0x80))
+      {
+         *p = q;
+         *v = val;
+         return 0;
+      }
+
+      shift += 7;
+   }
+
+   return -EAGAIN;
+}
+
+void gd_record_init(struct gd_record *rec)
+{
+   memset(rec, 0, sizeof(*rec));
+   mutex_init(&rec->read_lock);
+   init_waitqueue_head(&rec->wait);
+}
+
+static bool gd_record_emit_locked(struct gd_record *rec, const u8 *buf, unsigned int len)
+{
+   if(kfifo_avail(&rec->fifo) < len)
+   {
+      return false;
+   }
+
+   kfifo_in(&rec->fifo, buf, len);
+
+   if(wq_has_sleeper(&rec->wait))
+   {
+      wake_up_interruptible(&rec->wait);
+   }
+
+   return true;
+}
+
+/* a SYNC, behind a DROP if records were lost */
+static bool gd_record_sync_locked(struct gd_record *rec, u64 now)
+{
+   u8 buf[2 * GD_REC_MAX];
+   u8 *p = buf;
+
+   if(rec->dropped)
+   {
+      *p++ = GD_REC_DROP;
+      p = gd_rec_put(p, rec->dropped);
+   }
+
+   *p++ = GD_REC_SYNC;
+   *p++ = 'G';
+   *p++ = 'D';
+   *p++ = 'R';
+   p = gd_rec_put(p, GD_REC_VERSION);
+   p = gd_rec_put(p, now);
+
+   if(!gd_record_emit_locked(rec, buf, p - buf))
+   {
+      return false;
+   }
+
+   memset(rec->last_val, 0, sizeof(rec->last_val));
+   rec->last_time = now;
+   rec->last_tid = 0;
+   rec->since_sync = 0;
+   rec->dropped = 0;
+
+   return true;
+}
+
+/* one client access by task at board time now */
+void gd_record_access_locked(struct gd_record *rec, u64 now, unsigned int off, u32 val, bool write,
+                             struct task_struct *task)
+{
+   unsigned int reg = off / 4;
+   pid_t tid = gd_task_tid(task);
+   u8 buf[GD_REC_MAX];
+   u8 *p = buf;
+   u8 hdr = write ? GD_REC_WRITE : GD_REC_READ;
+
+   if(!rec->active)
+   {
+      return;
+   }
+
+   // board time goes back on a restore, deltas can't
+   if(rec->dropped || rec->since_sync >= GD_REC_SYNC_EVERY || now < rec->last_time)
+   {
+      if(!gd_record_sync_locked(rec, now))
+      {
+         rec->dropped++;
+         return;
+      }
+   }
+
+   if(tid != rec->last_tid)
+   {
+      hdr |= GD_REC_TID;
+   }
+
+   *p++ = hdr;
+   p = gd_rec_put(p, now - rec->last_time);
+   p = gd_rec_put(p, reg);
+   p = gd_rec_put(p, val ^ rec->last_val[reg]);
+   if(hdr & GD_REC_TID)
+   {
+      p = gd_rec_put(p, (u32)tid);
+   }
+
+   if(!gd_record_emit_locked(rec, buf, p - buf))
+   {
+      rec->dropped++;
+      return;
+   }
+
+   rec->last_time = now;
+   rec->last_val[reg] = val;
+   rec->last_tid = tid;
+   rec->since_sync++;
+}
+
+/* drop what hasn't been read, the stream picks up with a SYNC at the new
+ * board time */
+void gd_record_reset(struct gd_record *rec)
+{
+   struct gd_board *board = gd_record_board(rec);
+   unsigned long flags;
+
+   mutex_lock(&rec->read_lock);
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(rec->active)
+   {
+      kfifo_reset(&rec->fifo);
+      rec->dropped = 0;
+      gd_record_sync_locked(rec, gd_board_time(board));
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+   mutex_unlock(&rec->read_lock);
+}
+
+/* one reader at a time, recording runs while it's there */
+static int gd_record_open(struct inode *inode, struct file *filep)
+{
+   struct gd_record *rec = inode->i_private;
+   struct gd_board *board = gd_record_board(rec);
+   unsigned int size = rounddown_pow_of_two(max(record_buf_kb, 4u) * 1024);
+   unsigned long flags;
+   void *buf = NULL;
+   int ret = 0;
+
+   buf = vmalloc(size);
+   if(!buf)
+   {
+      return -ENOMEM;
+   }
+
+   mutex_lock(&rec->read_lock);
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(rec->active)
+   {
+      ret = -EBUSY;
+   }
+   else
+   {
+      kfifo_init(&rec->fifo, buf, size);
+      rec->buf = buf;
+      rec->dropped = 0;
+      rec->active = true;
+      gd_record_sync_locked(rec, gd_board_time(board));
+      buf = NULL;
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+   mutex_unlock(&rec->read_lock);
+
+   vfree(buf);
+
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   filep->private_data = rec;
+   return nonseekable_open(inode, filep);
+}
+
+static int gd_record_release(struct inode *inode, struct file *filep)
+{
+   struct gd_record *rec = filep->private_data;
+   struct gd_board *board = gd_record_board(rec);
+   unsigned long flags;
+   void *buf = NULL;
+
+   mutex_lock(&rec->read_lock);
+   spin_lock_irqsave(&board->lock, flags);
+
+   rec->active = false;
+   buf = rec->buf;
+   rec->buf = NULL;
+
+   spin_unlock_irqrestore(&board->lock, flags);
+   mutex_unlock(&rec->read_lock);
+
+   vfree(buf);
+
+   return 0;
+}
+
+static ssize_t gd_record_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_record *rec = filep->private_data;
+   unsigned int copied = 0;
+   int ret = 0;
+
+   if(mutex_lock_interruptible(&rec->read_lock))
+   {
+      return -ERESTARTSYS;
+   }
+
+   while(kfifo_is_empty(&rec->fifo))
+   {
+      mutex_unlock(&rec->read_lock);
+
+      if(filep->f_flags & O_NONBLOCK)
+      {
+         return -EAGAIN;
+      }
+
+      ret = wait_event_interruptible(rec->wait, !kfifo_is_empty(&rec->fifo));
+      if(ret != 0)
+      {
+         return ret;
+      }
+
+      if(mutex_lock_interruptible(&rec->read_lock))
+      {
+         return -ERESTARTSYS;
+      }
+   }
+
+   ret = kfifo_to_user(&rec->fifo, ubuf, count, &copied);
+
+   mutex_unlock(&rec->read_lock);
+
+   return ret ? ret : copied;
+}
+
+static __poll_t gd_record_poll(struct file *filep, poll_table *pt)
+{
+   struct gd_record *rec = filep->private_data;
+
+   poll_wait(filep, &rec->wait, pt);
+
+   return kfifo_is_empty(&rec->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations gd_record_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_record_open,
+   .release = gd_record_release,
+   .read = gd_record_read,
+   .poll = gd_record_poll,
+   .llseek = no_llseek,
+};
+
+void gd_record_debugfs(struct gd_record *rec, struct dentry *dir)
+{
+   debugfs_create_file("record", 0400, dir, rec, &gd_record_fops);
+}
+
+void gd_replay_init(struct gd_replay *rp)
+{
+   memset(rp, 0, sizeof(*rp));
+   mutex_init(&rp->write_lock);
+   init_waitqueue_head(&rp->wait);
+}
+
+void gd_replay_destroy(struct gd_replay *rp)
+{
+   if(kfifo_initialized(&rp->fifo))
+   {
+      kfifo_free(&rp->fifo);
+   }
+}
+
+/* the recorded value for a client gplev read, if replay has one */
+bool gd_replay_pop_locked(struct gd_replay *rp, unsigned int off, u32 *val)
+{
+   struct gd_replay_entry entry;
+
+   if(!rp->active || !kfifo_get(&rp->fifo, &entry))
+   {
+      return false;
+   }
+
+   if(entry.off != off)
+   {
+      rp->mismatches++;
+   }
+
+   *val = entry.val;
+
+   if(wq_has_sleeper(&rp->wait))
+   {
+      wake_up_interruptible(&rp->wait);
+   }
+
+   return true;
+}
+
+void gd_replay_reset(struct gd_replay *rp)
+{
+   struct gd_board *board = gd_replay_board(rp);
+   unsigned long flags;
+
+   mutex_lock(&rp->write_lock);
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(kfifo_initialized(&rp->fifo))
+   {
+      kfifo_reset(&rp->fifo);
+   }
+   rp->mismatches = 0;
+   rp->dropped = 0;
+   rp->active = rp->open;
+
+   spin_unlock_irqrestore(&board->lock, flags);
+   mutex_unlock(&rp->write_lock);
+}
+
+/* decode whole records out of buf, queueing the gplev reads. returns how many
+ * bytes at the end are a record cut short, or -EINVAL */
+static int gd_replay_decode(struct gd_replay *rp, const u8 *buf, size_t len)
+{
+   const u8 *p = buf;
+   const u8 *end = buf + len;
+
+   while(p < end)
+   {
+      struct gd_replay_entry entry;
+      const u8 *q = p;
+      u8 hdr = *q++;
+      u64 dt = 0;
+      u64 reg = 0;
+      u64 val = 0;
+      u64 tid = 0;
+      int err = 0;
+
+      switch(hdr & GD_REC_TYPE)
+      {
+         case GD_REC_SYNC:
+            if(end - q < 3)
+            {
+               err = -EAGAIN;
+               break;
+            }
+
+            if(memcmp(q, "GDR", 3) != 0)
+            {
+               err = -EINVAL;
+               break;
+            }
+
+            q += 3;
+            err = gd_rec_get(&q, end, &val) ?: gd_rec_get(&q, end, &dt);
+            if(!err && val != GD_REC_VERSION)
+            {
+               err = -EINVAL;
+            }
+
+            if(!err)
+            {
+               memset(rp->last_val, 0, sizeof(rp->last_val));
+            }
+            break;
+
+         case GD_REC_DROP:
+            err = gd_rec_get(&q, end, &val);
+            break;
+
+         case GD_REC_READ:
+         case GD_REC_WRITE:
+            err = gd_rec_get(&q, end, &dt) ?: gd_rec_get(&q, end, &reg) ?: gd_rec_get(&q, end, &val);
+            if(!err && (hdr & GD_REC_TID))
+            {
+               err = gd_rec_get(&q, end, &tid);
+            }
+
+            if(!err && reg >= GD_SNAPSHOT_REGS)
+            {
+               err = -EINVAL;
+            }
+
+            if(!err)
+            {
+               rp->last_val[reg] ^= (u32)val;
+
+               if((hdr & GD_REC_TYPE) == GD_REC_READ &&
+                  (reg == GD_GPLEV0 / 4 || reg == GD_GPLEV0 / 4 + 1))
+               {
+                  entry.off = reg * 4;
+                  entry.val = rp->last_val[reg];
+                  if(!kfifo_put(&rp->fifo, entry))
+                  {
+                     rp->dropped++;
+                  }
+               }
+            }
+            break;
+
+         default:
+            err = -EINVAL;
+            break;
+      }
+
+      if(err == -EAGAIN)
+      {
+         break;
+      }
+
+      if(err != 0)
+      {
+         pr_err("bad record 0x%02x at +%zu", hdr, p - buf);
+         return err;
+      }
+
+      p = q;
+   }
+
+   if(end - p > GD_REC_MAX)
+   {
+      return -EINVAL;
+   }
+
+   return end - p;
+}
+
+static int gd_replay_open(struct inode *inode, struct file *filep)
+{
+   struct gd_replay *rp = inode->i_private;
+   struct gd_board *board = gd_replay_board(rp);
+   unsigned long flags;
+   int ret = 0;
+
+   if((filep->f_flags & O_ACCMODE) != O_WRONLY)
+   {
+      return -EINVAL;
+   }
+
+   mutex_lock(&rp->write_lock);
+
+   if(rp->open)
+   {
+      ret = -EBUSY;
+      goto out;
+   }
+
+   if(!kfifo_initialized(&rp->fifo))
+   {
+      ret = kfifo_alloc(&rp->fifo, max(replay_entries, 2u * GD_REPLAY_ROOM), GFP_KERNEL);
+      if(ret != 0)
+      {
+         goto out;
+      }
+   }
+
+   rp->carry_len = 0;
+   memset(rp->last_val, 0, sizeof(rp->last_val));
+   rp->open = true;
+
+   spin_lock_irqsave(&board->lock, flags);
+   rp->active = true;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   filep->private_data = rp;
+
+out:
+   mutex_unlock(&rp->write_lock);
+   return ret ? ret : nonseekable_open(inode, filep);
+}
+
+/* replay stays on after close until the queue drains */
+static int gd_replay_release(struct inode *inode, struct file *filep)
+{
+   struct gd_replay *rp = filep->private_data;
+
+   mutex_lock(&rp->write_lock);
+   rp->open = false;
+   mutex_unlock(&rp->write_lock);
+
+   return 0;
+}
+
+/* takes the recording in chunks, waiting for the client to read its way
+ * through the queue when it's full */
+static ssize_t gd_replay_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_replay *rp = filep->private_data;
+   u8 *buf = NULL;
+   size_t done = 0;
+   int ret = 0;
+
+   buf = kmalloc(GD_REC_MAX + GD_REPLAY_CHUNK, GFP_KERNEL);
+   if(!buf)
+   {
+      return -ENOMEM;
+   }
+
+   if(mutex_lock_interruptible(&rp->write_lock))
+   {
+      kfree(buf);
+      return -ERESTARTSYS;
+   }
+
+   while(done < count)
+   {
+      size_t n = min_t(size_t, count - done, GD_REPLAY_CHUNK);
+
+      if(kfifo_avail(&rp->fifo) < GD_REPLAY_ROOM)
+      {
+         if(filep->f_flags & O_NONBLOCK)
+         {
+            ret = -EAGAIN;
+            break;
+         }
+
+         ret = wait_event_interruptible(rp->wait, kfifo_avail(&rp->fifo) >= GD_REPLAY_ROOM);
+         if(ret != 0)
+         {
+            break;
+         }
+      }
+
+      memcpy(buf, rp->carry, rp->carry_len);
+      if(copy_from_user(buf + rp->carry_len, ubuf + done, n))
+      {
+         ret = -EFAULT;
+         break;
+      }
+
+      ret = gd_replay_decode(rp, buf, rp->carry_len + n);
+      if(ret < 0)
+      {
+         break;
+      }
+
+      memcpy(rp->carry, buf + rp->carry_len + n - ret, ret);
+      rp->carry_len = ret;
+      ret = 0;
+
+      done += n;
+   }
+
+   mutex_unlock(&rp->write_lock);
+   kfree(buf);
+
+   return done ? done : ret;
+}
+
+static const struct file_operations gd_replay_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_replay_open,
+   .release = gd_replay_release,
+   .write = gd_replay_write,
+   .llseek = no_llseek,
+};
+
+void gd_replay_debugfs(struct gd_replay *rp, struct dentry *dir)
+{
+   debugfs_create_file("replay", 0200, dir, rp, &gd_replay_fops);
+   debugfs_create_u64("replay_mismatches", 0444, dir, &rp->mismatches);
+   debugfs_create_u64("replay_dropped", 0444, dir, &rp->dropped);
+}
@@ -0,0 +1,73 @@
+#ifndef GPIOMEM_DUMMY_RECORD_H_GUARD
+#define GPIOMEM_DUMMY_RECORD_H_GUARD
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/dcache.h>
+
+#include "gpiomem_dummy_ioctl.h"
+
+/* every client access as a binary stream, read from debugfs record. the
+ * format is in gpiomem_dummy_ioctl.h. recording runs while record is open */
+struct gd_record
+{
+   bool active; // under board->lock
+   struct mutex read_lock; // the one reader, and reset against it
+   wait_queue_head_t wait;
+   struct kfifo fifo; // bytes, single producer under board->lock
+   void *buf; // behind fifo, while active
+
+   // delta state, what the next record is encoded against
+   u64 last_time;
+   u32 last_val[GD_SNAPSHOT_REGS];
+   pid_t last_tid;
+   unsigned int since_sync;
+   u64 dropped; // records lost since the last one that made it
+};
+
+struct gd_replay_entry
+{
+   u32 off;
+   u32 val;
+};
+
+/* gplev values from a recording, handed to client reads in order instead of
+ * the model's. fed through debugfs replay */
+struct gd_replay
+{
+   bool active; // under board->lock
+   bool open;
+   struct mutex write_lock; // the writer's decoder state, and reset
+   wait_queue_head_t wait; // writer waiting for room
+   DECLARE_KFIFO_PTR(fifo, struct gd_replay_entry);
+   u64 mismatches; // a read of the other bank than recorded
+   u64 dropped; // values that didn't fit the queue, replay is out of step
+
+   // decoder state
+   u8 carry[GD_REC_MAX]; // a record split across writes
+   unsigned int carry_len;
+   u32 last_val[GD_SNAPSHOT_REGS];
+};
+
+static inline
+bool gd_record_active(struct gd_record *rec)
+{
+   return READ_ONCE(rec->active);
+}
+
+void gd_record_init(struct gd_record *rec);
+void gd_record_access_locked(struct gd_record *rec, u64 now, unsigned int off, u32 val, bool write,
+                             struct task_struct *task);
+void gd_record_reset(struct gd_record *rec);
+void gd_record_debugfs(struct gd_record *rec, struct dentry *dir);
+
+void gd_replay_init(struct gd_replay *rp);
+void gd_replay_destroy(struct gd_replay *rp);
+bool gd_replay_pop_locked(struct gd_replay *rp, unsigned int off, u32 *val);
+void gd_replay_reset(struct gd_replay *rp);
+void gd_replay_debugfs(struct gd_replay *rp, struct dentry *dir);
+
+#endif /* GPIOMEM_DUMMY_RECORD_H_GUARD */
@@ -0,0 +1,519 @@
+#include "gpiomem_dummy_relay.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "relay: "
+
+static unsigned int relay_subbuf_kb = 64;
+module_param(relay_subbuf_kb, uint, 0444);
+MODULE_PARM_DESC(relay_subbuf_kb, "size of an access trace sub-buffer in KiB");
+
+static unsigned int relay_subbufs = 8;
+module_param(relay_subbufs, uint, 0444);
+MODULE_PARM_DESC(relay_subbufs, "access trace sub-buffers per cpu");
+
+static inline
+struct gd_board *gd_relay_board(struct gd_relay *rl)
+{
+   return container_of(rl, struct gd_board, relay);
+}
+
+/* every sub-buffer opens with a header record, so a reader can pick the
+ * stream up at any of them. full buffers turn records away (no overwrite) */
+static int gd_relay_subbuf_start(struct rchan_buf *buf, void *subbuf, void *prev_subbuf, size_t prev_padding)
+{
+   struct gd_relay *rl = buf->chan->private_data;
+   struct gd_trace_rec *hdr = subbuf;
+
+   if(relay_buf_full(buf))
+   {
+      this_cpu_inc(rl->pcpu->lost);
+      return 0;
+   }
+
+   hdr->time = gd_board_time(gd_relay_board(rl));
+   hdr->val = this_cpu_xchg(rl->pcpu->lost, 0);
+   hdr->tid = buf->cpu;
+   hdr->pid = GD_TRACE_MAGIC;
+   hdr->off = 0;
+   hdr->flags = GD_TRACE_SUBBUF;
+
+   subbuf_start_reserve(buf, sizeof(*hdr));
+
+   return 1;
+}
+
+static struct dentry *gd_relay_create_buf_file(const char *filename, struct dentry *parent, umode_t mode,
+                                               struct rchan_buf *buf, int *is_global)
+{
+   return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int gd_relay_remove_buf_file(struct dentry *dentry)
+{
+   debugfs_remove(dentry);
+   return 0;
+}
+
+static struct rchan_callbacks gd_relay_callbacks = {
+   .subbuf_start = gd_relay_subbuf_start,
+   .create_buf_file = gd_relay_create_buf_file,
+   .remove_buf_file = gd_relay_remove_buf_file,
+};
+
+void gd_relay_init(struct gd_relay *rl)
+{
+   memset(rl, 0, sizeof(*rl));
+   mutex_init(&rl->lock);
+}
+
+void gd_relay_destroy(struct gd_relay *rl)
+{
+   mutex_lock(&rl->lock);
+
+   WRITE_ONCE(rl->enabled, false);
+   synchronize_rcu();
+
+   if(rl->chan)
+   {
+      relay_close(rl->chan);
+      rl->chan = NULL;
+   }
+
+   mutex_unlock(&rl->lock);
+
+   free_percpu(rl->pcpu);
+   rl->pcpu = NULL;
+
+   kfree(rcu_dereference_protected(rl->filter, true));
+   RCU_INIT_POINTER(rl->filter, NULL);
+}
+
+/* the pins a register access is about: the bank or fsel group it covers, or
+ * for the set/clear registers just the pins written */
+static u64 gd_relay_access_pins(unsigned int off, u32 val, bool write)
+{
+   unsigned int word = 0;
+   unsigned int shift = 0;
+
+   if(off <= GD_GPFSEL5)
+   {
+      return (0x3ffULL << (off / 4 * 10)) & GD_ALL_PINS;
+   }
+
+   if(off == GD_GPPUD)
+   {
+      return GD_ALL_PINS;
+   }
+
+   if(off == GD_GPPUDCLK0 || off == GD_GPPUDCLK0 + 4)
+   {
+      shift = off == GD_GPPUDCLK0 ? 0 : 32;
+      return ((write ? (u64)val : 0xffffffffULL) << shift) & GD_ALL_PINS;
+   }
+
+   if(off < GD_GPSET0 || off > GD_GPPUD)
+   {
+      return 0; // reserved
+   }
+
+   // GPSET0 to GPAFEN1 come in pairs with a reserved word after each
+   word = (off - GD_GPSET0) / 4 % 3;
+   if(word == 2)
+   {
+      return 0;
+   }
+
+   shift = word ? 32 : 0;
+
+   if(write && off < GD_GPLEV0)
+   {
+      return ((u64)val << shift) & GD_ALL_PINS;
+   }
+
+   return (0xffffffffULL << shift) & GD_ALL_PINS;
+}
+
+static bool gd_relay_filter_pass(struct gd_relay *rl, const struct gd_relay_filter *f,
+                                 unsigned int off, u32 val, bool write, struct task_struct *task)
+{
+   if(!(f->dirs & (write ? GD_TRACE_DIR_WRITE : GD_TRACE_DIR_READ)) ||
+      !(f->regs & (1ULL << (off / 4))))
+   {
+      return false;
+   }
+
+   if((f->pid && f->pid != gd_task_tid(task)) || (f->tgid && f->tgid != gd_task_tgid(task)))
+   {
+      return false;
+   }
+
+   if(!(f->pins & gd_relay_access_pins(off, val, write)))
+   {
+      return false;
+   }
+
+   if(f->sample > 1)
+   {
+      if(this_cpu_inc_return(rl->pcpu->sampled) < f->sample)
+      {
+         return false;
+      }
+
+      this_cpu_write(rl->pcpu->sampled, 0);
+   }
+
+   return true;
+}
+
+/* called outside the board lock, the buffers are per cpu. the filter goes
+ * first, so a dropped access costs no more than a few compares */
+void gd_relay_access(struct gd_relay *rl, unsigned int off, u32 val, bool write, struct task_struct *task)
+{
+   const struct gd_relay_filter *filter = NULL;
+   struct gd_trace_rec rec;
+
+   // reset and destroy wait this out before touching the channel
+   rcu_read_lock();
+
+   if(!READ_ONCE(rl->enabled))
+   {
+      goto out;
+   }
+
+   // sampling uses the per cpu counter
+   preempt_disable();
+
+   filter = rcu_dereference(rl->filter);
+   if(filter && !gd_relay_filter_pass(rl, filter, off, val, write, task))
+   {
+      preempt_enable();
+      goto out;
+   }
+
+   preempt_enable();
+
+   rec.time = gd_board_time(gd_relay_board(rl));
+   rec.val = val;
+   rec.tid = gd_task_tid(task);
+   rec.pid = gd_task_tgid(task);
+   rec.off = off;
+   rec.flags = write ? GD_TRACE_WRITE : 0;
+
+   relay_write(rl->chan, &rec, sizeof(rec));
+
+out:
+   rcu_read_unlock();
+}
+
+static int gd_relay_set_enabled(struct gd_relay *rl, bool enable)
+{
+   int ret = 0;
+
+   mutex_lock(&rl->lock);
+
+   if(enable && !rl->chan)
+   {
+      if(!rl->pcpu)
+      {
+         rl->pcpu = alloc_percpu(struct gd_relay_pcpu);
+      }
+
+      rl->chan = rl->pcpu ? relay_open("access", rl->dir, relay_subbuf_kb * 1024, relay_subbufs, &gd_relay_callbacks, rl) : NULL;
+      if(!rl->chan)
+      {
+         pr_err("failed to open relay channel");
+         ret = -ENOMEM;
+      }
+   }
+
+   if(ret == 0)
+   {
+      WRITE_ONCE(rl->enabled, enable);
+      if(!enable)
+      {
+         relay_flush(rl->chan);
+      }
+   }
+
+   mutex_unlock(&rl->lock);
+
+   return ret;
+}
+
+/* empty the buffers. whatever was in them and not read yet is gone */
+void gd_relay_reset(struct gd_relay *rl)
+{
+   bool enabled = false;
+   int cpu;
+
+   mutex_lock(&rl->lock);
+
+   if(rl->chan)
+   {
+      enabled = rl->enabled;
+      WRITE_ONCE(rl->enabled, false);
+      synchronize_rcu();
+
+      relay_reset(rl->chan);
+      for_each_possible_cpu(cpu)
+      {
+         per_cpu_ptr(rl->pcpu, cpu)->lost = 0;
+         per_cpu_ptr(rl->pcpu, cpu)->sampled = 0;
+      }
+
+      WRITE_ONCE(rl->enabled, enabled);
+   }
+
+   mutex_unlock(&rl->lock);
+}
+
+static ssize_t gd_relay_enable_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_relay *rl = filep->private_data;
+   char buf[3] = { gd_relay_enabled(rl) ? '1' : '0', '\n', 0 };
+
+   return simple_read_from_buffer(ubuf, count, ppos, buf, 2);
+}
+
+static ssize_t gd_relay_enable_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_relay *rl = filep->private_data;
+   bool enable = false;
+   int ret = 0;
+
+   ret = kstrtobool_from_user(ubuf, count, &enable);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   ret = gd_relay_set_enabled(rl, enable);
+
+   return ret ? ret : count;
+}
+
+static const struct file_operations gd_relay_enable_fops = {
+   .owner = THIS_MODULE,
+   .open = simple_open,
+   .read = gd_relay_enable_read,
+   .write = gd_relay_enable_write,
+};
+
+/* regs=0x34-0x3b,0x1c pins=0x8020000 dir=rw pid=0 tgid=0 sample=1, each
+ * optional. register ranges are byte offsets, inclusive */
+static int gd_relay_parse_regs(char *val, u64 *regs)
+{
+   char *range = NULL;
+
+   *regs = 0;
+
+   while((range = strsep(&val, ",")) != NULL)
+   {
+      char *hi = strchr(range, '-');
+      unsigned int start = 0;
+      unsigned int end = 0;
+
+      if(hi)
+      {
+         *hi++ = 0;
+      }
+
+      if(kstrtouint(range, 0, &start) != 0 || (hi && kstrtouint(hi, 0, &end) != 0))
+      {
+         return -EINVAL;
+      }
+
+      if(!hi)
+      {
+         end = start;
+      }
+
+      if(start > end || end >= GD_NUM_REGS * 4)
+      {
+         return -EINVAL;
+      }
+
+      for(start /= 4; start <= end / 4; start++)
+      {
+         *regs |= 1ULL << start;
+      }
+   }
+
+   return 0;
+}
+
+static int gd_relay_parse_filter(char *buf, struct gd_relay_filter *f)
+{
+   char *tok = NULL;
+   int ret = 0;
+
+   f->regs = (1ULL << GD_NUM_REGS) - 1;
+   f->pins = GD_ALL_PINS;
+   f->dirs = GD_TRACE_DIR_READ | GD_TRACE_DIR_WRITE;
+   f->pid = 0;
+   f->tgid = 0;
+   f->sample = 1;
+
+   while(ret == 0 && (tok = strsep(&buf, " \t\n")) != NULL)
+   {
+      char *val = strchr(tok, '=');
+
+      if(!*tok)
+      {
+         continue;
+      }
+
+      if(!val)
+      {
+         return -EINVAL;
+      }
+
+      *val++ = 0;
+
+      if(strcmp(tok, "regs") == 0)
+      {
+         ret = gd_relay_parse_regs(val, &f->regs);
+      }
+      else if(strcmp(tok, "pins") == 0)
+      {
+         ret = kstrtou64(val, 0, &f->pins);
+      }
+      else if(strcmp(tok, "dir") == 0)
+      {
+         f->dirs = (strchr(val, 'r') ? GD_TRACE_DIR_READ : 0) | (strchr(val, 'w') ? GD_TRACE_DIR_WRITE : 0);
+         ret = f->dirs ? 0 : -EINVAL;
+      }
+      else if(strcmp(tok, "pid") == 0)
+      {
+         ret = kstrtoint(val, 0, &f->pid);
+      }
+      else if(strcmp(tok, "tgid") == 0)
+      {
+         ret = kstrtoint(val, 0, &f->tgid);
+      }
+      else if(strcmp(tok, "sample") == 0)
+      {
+         ret = kstrtouint(val, 0, &f->sample);
+         ret = ret ?: (f->sample ? 0 : -EINVAL);
+      }
+      else
+      {
+         ret = -EINVAL;
+      }
+   }
+
+   return ret;
+}
+
+static ssize_t gd_relay_filter_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_relay *rl = filep->private_data;
+   const struct gd_relay_filter *f = NULL;
+   char buf[512];
+   size_t len = 0;
+   unsigned int reg;
+
+   rcu_read_lock();
+
+   f = rcu_dereference(rl->filter);
+   if(!f)
+   {
+      len = scnprintf(buf, sizeof(buf), "none\n");
+      goto out;
+   }
+
+   len += scnprintf(buf + len, sizeof(buf) - len, "regs=");
+   for(reg = 0; reg < GD_NUM_REGS; reg++)
+   {
+      unsigned int last = reg;
+
+      if(!(f->regs & (1ULL << reg)))
+      {
+         continue;
+      }
+
+      while(last + 1 < GD_NUM_REGS && (f->regs & (1ULL << (last + 1))))
+      {
+         last++;
+      }
+
+      len += scnprintf(buf + len, sizeof(buf) - len, "%s0x%x-0x%x", len > 5 ? "," : "", reg * 4, last * 4 + 3);
+      reg = last;
+   }
+
+   len += scnprintf(buf + len, sizeof(buf) - len, " pins=0x%llx dir=%s%s pid=%d tgid=%d sample=%u\n",
+      f->pins, f->dirs & GD_TRACE_DIR_READ ? "r" : "", f->dirs & GD_TRACE_DIR_WRITE ? "w" : "",
+      f->pid, f->tgid, f->sample);
+
+out:
+   rcu_read_unlock();
+
+   return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+/* each write replaces the whole filter, "none" (or nothing) traces all */
+static ssize_t gd_relay_filter_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_relay *rl = filep->private_data;
+   struct gd_relay_filter *f = NULL;
+   struct gd_relay_filter *old = NULL;
+   char *buf = NULL;
+   int ret = 0;
+
+   buf = memdup_user_nul(ubuf, min_t(size_t, count, PAGE_SIZE - 1));
+   if(IS_ERR(buf))
+   {
+      return PTR_ERR(buf);
+   }
+
+   if(strim(buf)[0] && strcmp(strim(buf), "none") != 0)
+   {
+      f = kzalloc(sizeof(*f), GFP_KERNEL);
+      ret = f ? gd_relay_parse_filter(buf, f) : -ENOMEM;
+   }
+
+   kfree(buf);
+
+   if(ret != 0)
+   {
+      kfree(f);
+      return ret;
+   }
+
+   mutex_lock(&rl->lock);
+   old = rcu_replace_pointer(rl->filter, f, lockdep_is_held(&rl->lock));
+   mutex_unlock(&rl->lock);
+
+   if(old)
+   {
+      kfree_rcu(old, rcu);
+   }
+
+   return count;
+}
+
+static const struct file_operations gd_relay_filter_fops = {
+   .owner = THIS_MODULE,
+   .open = simple_open,
+   .read = gd_relay_filter_read,
+   .write = gd_relay_filter_write,
+};
+
+void gd_relay_debugfs(struct gd_relay *rl, struct dentry *dir)
+{
+   rl->dir = dir;
+   debugfs_create_file("access_enable", 0600, dir, rl, &gd_relay_enable_fops);
+   debugfs_create_file("access_filter", 0600, dir, rl, &gd_relay_filter_fops);
+}
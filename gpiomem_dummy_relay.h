@@ -0,0 +1,60 @@
+#ifndef GPIOMEM_DUMMY_RELAY_H_GUARD
+#define GPIOMEM_DUMMY_RELAY_H_GUARD
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/relay.h>
+#include <linux/percpu.h>
+#include <linux/dcache.h>
+
+#include "gpiomem_dummy_ioctl.h"
+
+/* what makes it into the access trace, debugfs access_filter. an access has
+ * to pass all of it */
+struct gd_relay_filter
+{
+   struct rcu_head rcu;
+   u64 regs; // registers, bit n = offset 4n
+   u64 pins; // pins the register (or for GPSET/GPCLR, the value) touches
+   u32 dirs; // GD_TRACE_DIR_*
+   pid_t pid; // 0 for any
+   pid_t tgid;
+   u32 sample; // keep 1 in sample of what passes the rest
+};
+
+#define GD_TRACE_DIR_READ  0x1
+#define GD_TRACE_DIR_WRITE 0x2
+
+struct gd_relay_pcpu
+{
+   u32 lost; // records a full buffer turned away
+   u32 sampled; // passes towards the next kept sample
+};
+
+/* the access trace: fixed size gd_trace_rec's into per-cpu relay buffers,
+ * debugfs access0..accessN, for splice()ing straight to disk. switched with
+ * debugfs access_enable */
+struct gd_relay
+{
+   bool enabled;
+   struct mutex lock; // enable/reset/filter updates
+   struct rchan *chan; // created on first enable
+   struct dentry *dir;
+   struct gd_relay_pcpu __percpu *pcpu; // with chan
+   struct gd_relay_filter __rcu *filter; // NULL traces everything
+};
+
+static inline
+bool gd_relay_enabled(struct gd_relay *rl)
+{
+   return READ_ONCE(rl->enabled);
+}
+
+void gd_relay_init(struct gd_relay *rl);
+void gd_relay_destroy(struct gd_relay *rl);
+void gd_relay_access(struct gd_relay *rl, unsigned int off, u32 val, bool write, struct task_struct *task);
+void gd_relay_reset(struct gd_relay *rl);
+void gd_relay_debugfs(struct gd_relay *rl, struct dentry *dir);
+
+#endif /* GPIOMEM_DUMMY_RELAY_H_GUARD */
@@ -0,0 +1,222 @@
+#include "gpiomem_dummy_stats.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/ktime.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "stats: "
+
+void gd_stats_init(struct gd_stats *st)
+{
+   memset(st, 0, sizeof(*st));
+   mutex_init(&st->lock);
+}
+
+void gd_stats_destroy(struct gd_stats *st)
+{
+   free_percpu(st->pcpu);
+   st->pcpu = NULL;
+}
+
+static void gd_stats_zero(struct gd_stats *st)
+{
+   int cpu;
+
+   for_each_possible_cpu(cpu)
+   {
+      memset(per_cpu_ptr(st->pcpu, cpu), 0, sizeof(struct gd_stats_pcpu));
+   }
+
+   memset(st->prev_toggles, 0, sizeof(st->prev_toggles));
+   st->start = ktime_get_ns();
+   st->prev_time = st->start;
+}
+
+/* counting starts over now. an increment racing with this can survive it,
+ * which a per-test reset doesn't mind */
+void gd_stats_reset(struct gd_stats *st)
+{
+   mutex_lock(&st->lock);
+
+   if(st->pcpu)
+   {
+      gd_stats_zero(st);
+   }
+
+   mutex_unlock(&st->lock);
+}
+
+static int gd_stats_set_enabled(struct gd_stats *st, bool enable)
+{
+   int ret = 0;
+
+   mutex_lock(&st->lock);
+
+   if(enable && !st->pcpu)
+   {
+      st->pcpu = alloc_percpu(struct gd_stats_pcpu);
+      if(!st->pcpu)
+      {
+         ret = -ENOMEM;
+      }
+   }
+
+   if(ret == 0)
+   {
+      if(enable && !st->enabled)
+      {
+         gd_stats_zero(st);
+      }
+
+      // the hot path finds pcpu set up once it sees enabled
+      smp_store_release(&st->enabled, enable);
+   }
+
+   mutex_unlock(&st->lock);
+
+   return ret;
+}
+
+/* events per second over ns, to a tenth of a hertz */
+static void gd_stats_rate(struct seq_file *m, u64 count, u64 ns)
+{
+   u64 dhz = ns ? mul_u64_u64_div_u64(count, 10 * NSEC_PER_SEC, ns) : 0;
+   u32 tenths = 0;
+
+   dhz = div_u64_rem(dhz, 10, &tenths);
+   seq_printf(m, " %llu.%u", dhz, tenths);
+}
+
+static int gd_stats_show(struct seq_file *m, void *v)
+{
+   struct gd_stats *st = m->private;
+   struct gd_stats_pcpu *sum = NULL;
+   u64 now = 0;
+   unsigned int i;
+   int cpu;
+
+   sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+   if(!sum)
+   {
+      return -ENOMEM;
+   }
+
+   mutex_lock(&st->lock);
+
+   if(!st->pcpu)
+   {
+      seq_puts(m, "disabled\n");
+      goto out;
+   }
+
+   for_each_possible_cpu(cpu)
+   {
+      struct gd_stats_pcpu *pcpu = per_cpu_ptr(st->pcpu, cpu);
+
+      for(i = 0; i < GD_NUM_PINS; i++)
+      {
+         sum->toggles[i] += READ_ONCE(pcpu->toggles[i]);
+      }
+
+      for(i = 0; i < GD_NUM_REGS; i++)
+      {
+         sum->reads[i] += READ_ONCE(pcpu->reads[i]);
+         sum->writes[i] += READ_ONCE(pcpu->writes[i]);
+      }
+   }
+
+   now = ktime_get_ns();
+
+   seq_printf(m, "enabled %d\nelapsed_ns %llu\n\n", st->enabled, now - st->start);
+
+   // rates since counting started, and since this file was last read
+   seq_puts(m, "pin toggles hz recent_hz\n");
+   for(i = 0; i < GD_NUM_PINS; i++)
+   {
+      if(!sum->toggles[i])
+      {
+         continue;
+      }
+
+      seq_printf(m, "%u %llu", i, sum->toggles[i]);
+      gd_stats_rate(m, sum->toggles[i], now - st->start);
+      gd_stats_rate(m, sum->toggles[i] - st->prev_toggles[i], now - st->prev_time);
+      seq_putc(m, '\n');
+   }
+
+   seq_puts(m, "\nreg reads writes\n");
+   for(i = 0; i < GD_NUM_REGS; i++)
+   {
+      if(sum->reads[i] || sum->writes[i])
+      {
+         seq_printf(m, "0x%02x %llu %llu\n", i * 4, sum->reads[i], sum->writes[i]);
+      }
+   }
+
+   memcpy(st->prev_toggles, sum->toggles, sizeof(st->prev_toggles));
+   st->prev_time = now;
+
+out:
+   mutex_unlock(&st->lock);
+   kfree(sum);
+   return 0;
+}
+
+static int gd_stats_open(struct inode *inode, struct file *filep)
+{
+   return single_open(filep, gd_stats_show, inode->i_private);
+}
+
+static const struct file_operations gd_stats_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_stats_open,
+   .read = seq_read,
+   .llseek = seq_lseek,
+   .release = single_release,
+};
+
+static ssize_t gd_stats_enable_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_stats *st = filep->private_data;
+   char buf[3] = { gd_stats_enabled(st) ? '1' : '0', '\n', 0 };
+
+   return simple_read_from_buffer(ubuf, count, ppos, buf, 2);
+}
+
+static ssize_t gd_stats_enable_write(struct file *filep, const char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_stats *st = filep->private_data;
+   bool enable = false;
+   int ret = 0;
+
+   ret = kstrtobool_from_user(ubuf, count, &enable);
+   if(ret != 0)
+   {
+      return ret;
+   }
+
+   ret = gd_stats_set_enabled(st, enable);
+
+   return ret ? ret : count;
+}
+
+static const struct file_operations gd_stats_enable_fops = {
+   .owner = THIS_MODULE,
+   .open = simple_open,
+   .read = gd_stats_enable_read,
+   .write = gd_stats_enable_write,
+};
+
+void gd_stats_debugfs(struct gd_stats *st, struct dentry *dir)
+{
+   debugfs_create_file("stats_enable", 0600, dir, st, &gd_stats_enable_fops);
+   debugfs_create_file("stats", 0400, dir, st, &gd_stats_fops);
+}
@@ -0,0 +1,80 @@
+#ifndef GPIOMEM_DUMMY_STATS_H_GUARD
+#define GPIOMEM_DUMMY_STATS_H_GUARD
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/dcache.h>
+
+#include "gpiomem_dummy_ioctl.h"
+
+struct gd_stats_pcpu
+{
+   u64 toggles[GD_SNAPSHOT_PINS];
+   u64 reads[GD_SNAPSHOT_REGS];
+   u64 writes[GD_SNAPSHOT_REGS];
+};
+
+/* counts only, no events: per cpu counters bumped on the emulation path and
+ * folded when debugfs stats is read. switched with debugfs stats_enable */
+struct gd_stats
+{
+   bool enabled;
+   struct mutex lock; // enable/reset/fold
+   struct gd_stats_pcpu __percpu *pcpu; // from the first enable on
+   u64 start; // ktime_get_ns() counting started, board time can jump on restore
+
+   // the previous read, for the recent rates
+   u64 prev_time;
+   u64 prev_toggles[GD_SNAPSHOT_PINS];
+};
+
+static inline
+bool gd_stats_enabled(struct gd_stats *st)
+{
+   return smp_load_acquire(&st->enabled);
+}
+
+/* pins that changed level. called under the board lock */
+static inline
+void gd_stats_toggles(struct gd_stats *st, u64 changed)
+{
+   struct gd_stats_pcpu *pcpu = NULL;
+
+   if(!gd_stats_enabled(st))
+   {
+      return;
+   }
+
+   pcpu = this_cpu_ptr(st->pcpu);
+   while(changed)
+   {
+      pcpu->toggles[__ffs64(changed)]++;
+      changed &= changed - 1;
+   }
+}
+
+static inline
+void gd_stats_access(struct gd_stats *st, unsigned int off, bool write)
+{
+   if(!gd_stats_enabled(st))
+   {
+      return;
+   }
+
+   if(write)
+   {
+      this_cpu_inc(st->pcpu->writes[off / 4]);
+   }
+   else
+   {
+      this_cpu_inc(st->pcpu->reads[off / 4]);
+   }
+}
+
+void gd_stats_init(struct gd_stats *st);
+void gd_stats_destroy(struct gd_stats *st);
+void gd_stats_reset(struct gd_stats *st);
+void gd_stats_debugfs(struct gd_stats *st, struct dentry *dir);
+
+#endif /* GPIOMEM_DUMMY_STATS_H_GUARD */
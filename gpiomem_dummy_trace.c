@@ -0,0 +1,3 @@
+/* instantiates the tracepoints, everyone else just includes the header */
+#define CREATE_TRACE_POINTS
+#include "gpiomem_dummy_trace.h"
@@ -0,0 +1,75 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM gpiomem_dummy
+
+#if !defined(GPIOMEM_DUMMY_TRACE_H_GUARD) || defined(TRACE_HEADER_MULTI_READ)
+#define GPIOMEM_DUMMY_TRACE_H_GUARD
+
+#include <linux/tracepoint.h>
+
+#include "gpiomem_dummy_ioctl.h"
+
+/* tracepoints on the access path. each takes one pointer to a struct from
+ * gpiomem_dummy_ioctl.h, which is what raw tracepoint and tp_btf bpf
+ * programs get as their only argument. perf and ftrace see the same fields
+ * through the usual event format */
+
+TRACE_EVENT(gd_access,
+
+   TP_PROTO(const struct gd_bpf_access *ctx),
+
+   TP_ARGS(ctx),
+
+   TP_STRUCT__entry(
+      __field(__u64, time)
+      __field(__u32, off)
+      __field(__u32, val)
+      __field(__u32, flags)
+      __field(__u32, pid)
+      __field(__u32, tid)
+   ),
+
+   TP_fast_assign(
+      __entry->time = ctx->time;
+      __entry->off = ctx->off;
+      __entry->val = ctx->val;
+      __entry->flags = ctx->flags;
+      __entry->pid = ctx->pid;
+      __entry->tid = ctx->tid;
+   ),
+
+   TP_printk("time=%llu %s off=0x%02x val=0x%08x pid=%u tid=%u",
+             __entry->time, (__entry->flags & GD_BPF_WRITE) ? "write" : "read",
+             __entry->off, __entry->val, __entry->pid, __entry->tid)
+);
+
+TRACE_EVENT(gd_pins,
+
+   TP_PROTO(const struct gd_bpf_pins *ctx),
+
+   TP_ARGS(ctx),
+
+   TP_STRUCT__entry(
+      __field(__u64, time)
+      __field(__u64, level)
+      __field(__u64, rising)
+      __field(__u64, falling)
+   ),
+
+   TP_fast_assign(
+      __entry->time = ctx->time;
+      __entry->level = ctx->level;
+      __entry->rising = ctx->rising;
+      __entry->falling = ctx->falling;
+   ),
+
+   TP_printk("time=%llu level=0x%014llx rising=0x%014llx falling=0x%014llx",
+             __entry->time, __entry->level, __entry->rising, __entry->falling)
+);
+
+#endif /* GPIOMEM_DUMMY_TRACE_H_GUARD */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gpiomem_dummy_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,344 @@
+#include "gpiomem_dummy_vcd.h"
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+
+#include "gpiomem_dummy.h"
+#include "gpiomem_dummy_compat.h"
+
+#define LOG_PREFIX LOG_PREFIX_ "vcd: "
+
+static unsigned int vcd_events = 65536;
+module_param(vcd_events, uint, 0644);
+MODULE_PARM_DESC(vcd_events, "level changes queued for the vcd reader, a reader further behind loses some");
+
+// longest text one event turns into: a timestamp and every pin changing
+#define GD_VCD_EVENT_MAX (24 + GD_NUM_PINS * 3)
+
+/* per open file, the text side */
+struct gd_vcd_reader
+{
+   struct gd_vcd *vcd;
+   char *buf; // formatted, not yet read
+   size_t len;
+   size_t pos;
+   u64 last_level;
+   u64 last_time;
+};
+
+static inline
+struct gd_board *gd_vcd_board(struct gd_vcd *vcd)
+{
+   return container_of(vcd, struct gd_board, vcd);
+}
+
+/* one character identifiers, '!' onwards */
+static inline
+char gd_vcd_id(unsigned int pin)
+{
+   return '!' + pin;
+}
+
+void gd_vcd_init(struct gd_vcd *vcd)
+{
+   memset(vcd, 0, sizeof(*vcd));
+   mutex_init(&vcd->read_lock);
+   init_waitqueue_head(&vcd->wait);
+}
+
+/* the hot path: one copy into the queue, no text */
+void gd_vcd_event_locked(struct gd_vcd *vcd, u64 now, u64 level)
+{
+   struct gd_vcd_event ev = { .time = now, .level = level };
+
+   if(!vcd->active)
+   {
+      return;
+   }
+
+   if(!kfifo_put(&vcd->fifo, ev))
+   {
+      vcd->lost++;
+      return;
+   }
+
+   if(wq_has_sleeper(&vcd->wait))
+   {
+      wake_up_interruptible(&vcd->wait);
+   }
+}
+
+/* drop queued events, the dump carries on from the board's state now */
+void gd_vcd_reset(struct gd_vcd *vcd)
+{
+   struct gd_board *board = gd_vcd_board(vcd);
+   unsigned long flags;
+
+   mutex_lock(&vcd->read_lock);
+   spin_lock_irqsave(&board->lock, flags);
+
+   if(vcd->active)
+   {
+      kfifo_reset(&vcd->fifo);
+      vcd->lost = 0;
+      gd_vcd_event_locked(vcd, gd_board_time(board), board->level);
+   }
+
+   spin_unlock_irqrestore(&board->lock, flags);
+   mutex_unlock(&vcd->read_lock);
+}
+
+static size_t gd_vcd_header(struct gd_vcd_reader *rd, char *buf, size_t size)
+{
+   size_t len = 0;
+   unsigned int pin;
+
+   len += scnprintf(buf + len, size - len,
+      "$version gpiomem_dummy $end\n"
+      "$timescale 1ns $end\n"
+      "$scope module gpio $end\n");
+
+   for(pin = 0; pin < GD_NUM_PINS; pin++)
+   {
+      len += scnprintf(buf + len, size - len, "$var wire 1 %c gpio%u $end\n", gd_vcd_id(pin), pin);
+   }
+
+   len += scnprintf(buf + len, size - len,
+      "$upscope $end\n"
+      "$enddefinitions $end\n"
+      "#%llu\n"
+      "$dumpvars\n", rd->last_time);
+
+   for(pin = 0; pin < GD_NUM_PINS; pin++)
+   {
+      len += scnprintf(buf + len, size - len, "%c%c\n", (rd->last_level >> pin) & 1 ? '1' : '0', gd_vcd_id(pin));
+   }
+
+   len += scnprintf(buf + len, size - len, "$end\n");
+
+   return len;
+}
+
+static size_t gd_vcd_format(struct gd_vcd_reader *rd, const struct gd_vcd_event *ev, char *buf, size_t size)
+{
+   u64 changed = (ev->level ^ rd->last_level) & GD_ALL_PINS;
+   size_t len = 0;
+
+   if(!changed)
+   {
+      return 0;
+   }
+
+   // vcd time only goes forward, board time doesn't (reset, restore)
+   if(ev->time > rd->last_time)
+   {
+      rd->last_time = ev->time;
+      len += scnprintf(buf + len, size - len, "#%llu\n", rd->last_time);
+   }
+
+   while(changed)
+   {
+      unsigned int pin = __ffs64(changed);
+
+      changed &= changed - 1;
+      len += scnprintf(buf + len, size - len, "%c%c\n", (ev->level >> pin) & 1 ? '1' : '0', gd_vcd_id(pin));
+   }
+
+   rd->last_level = ev->level;
+
+   return len;
+}
+
+/* format as many queued events as fit in the buffer */
+static void gd_vcd_fill(struct gd_vcd_reader *rd)
+{
+   struct gd_vcd *vcd = rd->vcd;
+   struct gd_board *board = gd_vcd_board(vcd);
+   struct gd_vcd_event ev;
+   unsigned long flags;
+   u64 lost = 0;
+
+   rd->len = 0;
+   rd->pos = 0;
+
+   spin_lock_irqsave(&board->lock, flags);
+   lost = vcd->lost;
+   vcd->lost = 0;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   if(lost)
+   {
+      rd->len += scnprintf(rd->buf + rd->len, PAGE_SIZE - rd->len, "$comment %llu changes lost $end\n", lost);
+   }
+
+   while(rd->len + GD_VCD_EVENT_MAX <= PAGE_SIZE && kfifo_get(&vcd->fifo, &ev))
+   {
+      rd->len += gd_vcd_format(rd, &ev, rd->buf + rd->len, PAGE_SIZE - rd->len);
+   }
+}
+
+static int gd_vcd_open(struct inode *inode, struct file *filep)
+{
+   struct gd_vcd *vcd = inode->i_private;
+   struct gd_board *board = gd_vcd_board(vcd);
+   struct gd_vcd_reader *rd = NULL;
+   unsigned long flags;
+   int ret = 0;
+
+   rd = kzalloc(sizeof(*rd), GFP_KERNEL);
+   if(!rd)
+   {
+      return -ENOMEM;
+   }
+
+   rd->vcd = vcd;
+   rd->buf = (char *)__get_free_page(GFP_KERNEL);
+   if(!rd->buf)
+   {
+      kfree(rd);
+      return -ENOMEM;
+   }
+
+   mutex_lock(&vcd->read_lock);
+
+   if(kfifo_initialized(&vcd->fifo))
+   {
+      ret = -EBUSY;
+      goto out;
+   }
+
+   ret = kfifo_alloc(&vcd->fifo, max(vcd_events, 64u), GFP_KERNEL);
+   if(ret != 0)
+   {
+      goto out;
+   }
+
+   spin_lock_irqsave(&board->lock, flags);
+   rd->last_level = board->level;
+   rd->last_time = gd_board_time(board);
+   vcd->lost = 0;
+   vcd->active = true;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   rd->len = gd_vcd_header(rd, rd->buf, PAGE_SIZE);
+   filep->private_data = rd;
+
+out:
+   mutex_unlock(&vcd->read_lock);
+
+   if(ret != 0)
+   {
+      free_page((unsigned long)rd->buf);
+      kfree(rd);
+      return ret;
+   }
+
+   return nonseekable_open(inode, filep);
+}
+
+static int gd_vcd_release(struct inode *inode, struct file *filep)
+{
+   struct gd_vcd_reader *rd = filep->private_data;
+   struct gd_vcd *vcd = rd->vcd;
+   struct gd_board *board = gd_vcd_board(vcd);
+   unsigned long flags;
+
+   mutex_lock(&vcd->read_lock);
+
+   spin_lock_irqsave(&board->lock, flags);
+   vcd->active = false;
+   spin_unlock_irqrestore(&board->lock, flags);
+
+   kfifo_free(&vcd->fifo);
+
+   mutex_unlock(&vcd->read_lock);
+
+   free_page((unsigned long)rd->buf);
+   kfree(rd);
+
+   return 0;
+}
+
+/* like trace_pipe: blocks until there's something, and what's read is gone */
+static ssize_t gd_vcd_read(struct file *filep, char __user *ubuf, size_t count, loff_t *ppos)
+{
+   struct gd_vcd_reader *rd = filep->private_data;
+   struct gd_vcd *vcd = rd->vcd;
+   size_t n = 0;
+   int ret = 0;
+
+   if(mutex_lock_interruptible(&vcd->read_lock))
+   {
+      return -ERESTARTSYS;
+   }
+
+   while(rd->pos == rd->len)
+   {
+      gd_vcd_fill(rd);
+      if(rd->len)
+      {
+         break;
+      }
+
+      mutex_unlock(&vcd->read_lock);
+
+      if(filep->f_flags & O_NONBLOCK)
+      {
+         return -EAGAIN;
+      }
+
+      ret = wait_event_interruptible(vcd->wait, !kfifo_is_empty(&vcd->fifo) || READ_ONCE(vcd->lost));
+      if(ret != 0)
+      {
+         return ret;
+      }
+
+      if(mutex_lock_interruptible(&vcd->read_lock))
+      {
+         return -ERESTARTSYS;
+      }
+   }
+
+   n = min(count, rd->len - rd->pos);
+   if(copy_to_user(ubuf, rd->buf + rd->pos, n))
+   {
+      ret = -EFAULT;
+   }
+   else
+   {
+      rd->pos += n;
+   }
+
+   mutex_unlock(&vcd->read_lock);
+
+   return ret ? ret : n;
+}
+
+static __poll_t gd_vcd_poll(struct file *filep, poll_table *pt)
+{
+   struct gd_vcd_reader *rd = filep->private_data;
+   struct gd_vcd *vcd = rd->vcd;
+
+   poll_wait(filep, &vcd->wait, pt);
+
+   return rd->pos != rd->len || !kfifo_is_empty(&vcd->fifo) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static const struct file_operations gd_vcd_fops = {
+   .owner = THIS_MODULE,
+   .open = gd_vcd_open,
+   .release = gd_vcd_release,
+   .read = gd_vcd_read,
+   .poll = gd_vcd_poll,
+   .llseek = no_llseek,
+};
+
+void gd_vcd_debugfs(struct gd_vcd *vcd, struct dentry *dir)
+{
+   debugfs_create_file("vcd", 0400, dir, vcd, &gd_vcd_fops);
+}
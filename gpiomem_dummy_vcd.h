@@ -0,0 +1,38 @@
+#ifndef GPIOMEM_DUMMY_VCD_H_GUARD
+#define GPIOMEM_DUMMY_VCD_H_GUARD
+
+#include <linux/types.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/dcache.h>
+
+struct gd_vcd_event
+{
+   u64 time; // board time
+   u64 level; // GPLEV after the change
+};
+
+/* pin activity as a value change dump, debugfs vcd. level changes are queued
+ * as raw events while it's open, and only turned into text as it's read */
+struct gd_vcd
+{
+   bool active; // under board->lock
+   struct mutex read_lock; // the one reader
+   wait_queue_head_t wait;
+   DECLARE_KFIFO_PTR(fifo, struct gd_vcd_event); // single producer under board->lock
+   u64 lost; // events that didn't fit, under board->lock
+};
+
+static inline
+bool gd_vcd_active(struct gd_vcd *vcd)
+{
+   return READ_ONCE(vcd->active);
+}
+
+void gd_vcd_init(struct gd_vcd *vcd);
+void gd_vcd_event_locked(struct gd_vcd *vcd, u64 now, u64 level);
+void gd_vcd_reset(struct gd_vcd *vcd);
+void gd_vcd_debugfs(struct gd_vcd *vcd, struct dentry *dir);
+
+#endif /* GPIOMEM_DUMMY_VCD_H_GUARD */